@@ -1,13 +1,51 @@
 #version 460
 
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
 layout (location = 0) in vec2 texcrood;
 
+#ifdef INDIRECT
+layout (location = 1) flat in uint texture_id;
+#endif
+
 layout (location = 0) out vec4 out_color;
 
+#ifdef BINDLESS
+/* every mesh texture, partially bound, the draw picks one */
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+
+#ifndef INDIRECT
+layout (push_constant) uniform MATERIAL
+{
+    uint texture_id;
+} material;
+#endif
+#else
 layout (set = 1, binding = 0) uniform sampler2D tex;
+#endif
 
 void main()
 {
+#ifdef INDIRECT
+    /* draws of one call meet in a subgroup, the index is not uniform */
+    if (texture_id == 0xffffffffu) {
+        out_color = vec4(1.f);
+        return;
+    }
+
+    vec3 color = texture(textures[nonuniformEXT(texture_id)], texcrood).xyz;
+#elif defined(BINDLESS)
+    /* NO_TEXTURE, the element was never written */
+    if (material.texture_id == 0xffffffffu) {
+        out_color = vec4(1.f);
+        return;
+    }
+
+    vec3 color = texture(textures[material.texture_id], texcrood).xyz;
+#else
     vec3 color = texture(tex, texcrood).xyz;
+#endif
     out_color = vec4(color, 1.f);
 }
\ No newline at end of file
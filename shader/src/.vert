@@ -6,6 +6,10 @@ layout (location = 2) in vec2 v_texcrood;
 
 layout (location = 0) out vec2 out_texcrood;
 
+#ifdef INDIRECT
+layout (location = 1) flat out uint out_texture_id;
+#endif
+
 layout (set = 0, binding = 0) uniform readonly RENDER_MAT
 {
     mat4 view;
@@ -13,8 +17,30 @@ layout (set = 0, binding = 0) uniform readonly RENDER_MAT
     mat4 model;
 } render_mat;
 
+#ifdef INDIRECT
+/* one per draw, its index is firstInstance, render_mat.model is unused */
+struct draw
+{
+    mat4 model;
+    uint texture_id;
+};
+
+layout (std430, set = 2, binding = 0) readonly buffer DRAWS
+{
+    draw draws[];
+};
+#endif
+
 void main()
 {
-    gl_Position = render_mat.proj * render_mat.view * render_mat.model * vec4(v_pos, 1.f);
+#ifdef INDIRECT
+    /* culling reorders the commands, gl_DrawID no longer finds the draw */
+    mat4 model = draws[gl_InstanceIndex].model;
+    out_texture_id = draws[gl_InstanceIndex].texture_id;
+#else
+    mat4 model = render_mat.model;
+#endif
+
+    gl_Position = render_mat.proj * render_mat.view * model * vec4(v_pos, 1.f);
     out_texcrood = v_texcrood;
 }
\ No newline at end of file
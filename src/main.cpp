@@ -1,56 +1,197 @@
 #include "vk_engine.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 
 #include <SDL3/SDL.h>
 #include <imgui.h>
 
 #include "vk_boiler.h"
+#include "vk_cache.h"
+#include "vk_cloud.h"
 #include "vk_cmd.h"
 #include "vk_comp.h"
 #include "vk_pipeline.h"
 #include "vk_type.h"
 
-struct camera_data {
-    alignas(16) glm::vec3 pos;
-    alignas(16) glm::vec3 dir;
-    alignas(16) glm::vec3 up;
-    alignas(4) float fov;
-};
-
-struct cloud_data {
-    alignas(4) float type;
-    alignas(4) float freq;
-    alignas(4) float ambient;
-    alignas(4) float sigma_a;
-    alignas(4) float sigma_s;
-    alignas(4) float step;
-    alignas(4) int max_steps;
-    alignas(4) float cutoff;
-    alignas(4) float density;
-    alignas(16) glm::vec3 sun_color;
-    alignas(16) glm::vec3 sky_color;
-};
-
 /*
     earth radius = 6371000m;
     mt. everest height = 9000m;
     cloud appears at above = 1500m;
 */
 
-static uint32_t cloudtex_size = 128;
-static uint32_t weather_size = 512;
 static bool cloud_ui = true;
-static cloud_data cloud_data;
+
+/* texels a side of a cached weather map tile, refreshed _weather_tiles a frame */
+static const uint32_t weather_tile = 64;
+
+/* worley feature points precomputed a side, worley_cells in the shaders */
+static const uint32_t worley_cells = 64;
+
+/* temporal mode traces the pixels of each 4x4 block in bayer order */
+static const uint32_t temporal_stride = 4;
+static const glm::ivec2 bayer[16] = {
+    {0, 0}, {2, 2}, {2, 0}, {0, 2}, {1, 1}, {3, 3}, {3, 1}, {1, 3},
+    {1, 0}, {3, 2}, {3, 0}, {1, 2}, {0, 1}, {2, 3}, {2, 1}, {0, 3},
+};
+
+/* sun transmittance volume over the shell, refreshed light_slab slices at a time */
+static const VkExtent3D light_extent = {128, 64, 128};
+static const uint32_t light_slab = 4;
+
+/* light.comp runs light_slab deep groups, one slab a row of them */
+static const vk_tune::workgroup light_group = {4, 4};
+
+/* the fields light.comp reads, weather_offset is covered by _weather_version */
+static bool light_changed(const cloud_data &a, const cloud_data &b)
+{
+    return a.type != b.type || a.freq != b.freq || a.step != b.step ||
+           a.cutoff != b.cutoff || a.density != b.density || a.sun_dir != b.sun_dir;
+}
+
+/* usage and levels of a noise image, sampled ones get a full mip chain */
+static const VkImageUsageFlags sampled_usage = VK_IMAGE_USAGE_STORAGE_BIT |
+                                               VK_IMAGE_USAGE_SAMPLED_BIT |
+                                               VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                               VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+static uint32_t mip_count(uint32_t size)
+{
+    uint32_t levels = 1;
+    while (size >>= 1)
+        levels++;
+
+    return levels;
+}
+
+#ifndef VK_ENGINE_BENCH
+/* _target is B8G8R8A8, write it out as binary rgb ppm */
+static bool write_ppm(const char *filename, VkExtent2D extent,
+                      const std::vector<unsigned char> &pixels)
+{
+    std::ofstream f(filename, std::ios::binary);
+
+    if (!f.is_open()) {
+        std::cerr << "failed to open " << filename << std::endl;
+        return false;
+    }
+
+    f << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+
+    for (size_t i = 0; i + 3 < pixels.size(); i += 4) {
+        unsigned char rgb[3] = { pixels[i + 2], pixels[i + 1], pixels[i] };
+        f.write((const char *)rgb, 3);
+    }
+
+    return true;
+}
+
+/* a whole number in [min, max] or a message, 0 and garbage divide or loop on the gpu */
+static bool parse_count(const char *flag, const char *arg, uint32_t min, uint32_t max,
+                        uint32_t *value)
+{
+    char *end;
+    unsigned long n = std::strtoul(arg, &end, 10);
+
+    if (end == arg || *end || n < min || n > max) {
+        std::cerr << flag << ": expected a number from " << min << " to " << max
+                  << ", got " << arg << std::endl;
+        return false;
+    }
+
+    *value = (uint32_t)n;
+    return true;
+}
 
 int main(int argc, char *argv[])
 {
     vk_engine engine = {};
+    const char *output = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--headless"))
+            engine._headless = true;
+        else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc)
+            engine._max_frames = std::strtoull(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--profile") && i + 1 < argc) {
+            engine._profile_path = argv[++i];
+            engine._cache_stats = true;
+        } else if (!std::strcmp(argv[i], "--noise-cache") && i + 1 < argc)
+            engine._noise_cache = argv[++i];
+        else if (!std::strcmp(argv[i], "--no-noise-cache"))
+            engine._noise_cache = nullptr;
+        else if (!std::strcmp(argv[i], "--sampled"))
+            engine._sampled = true;
+        else if (!std::strcmp(argv[i], "--temporal"))
+            engine._temporal = true;
+        else if (!std::strcmp(argv[i], "--cloud-scale") && i + 1 < argc) {
+            if (!parse_count(argv[i], argv[i + 1], 1, 16, &engine._cloud_scale))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--weather-live"))
+            engine._weather_cache = false;
+        else if (!std::strcmp(argv[i], "--weather-tiles") && i + 1 < argc) {
+            /* more than the map has refreshes all of it */
+            if (!parse_count(argv[i], argv[i + 1], 1, 4096, &engine._weather_tiles))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--light-slabs") && i + 1 < argc) {
+            /* 32 slabs of light_slab in the volume */
+            if (!parse_count(argv[i], argv[i + 1], 1, 32, &engine._light_slabs))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--light-steps") && i + 1 < argc) {
+            if (!parse_count(argv[i], argv[i + 1], 1, 64, &engine._light_steps))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--weather-octaves") && i + 1 < argc) {
+            if (!parse_count(argv[i], argv[i + 1], 1, 24, &engine._weather_octaves))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--tune-cache") && i + 1 < argc)
+            engine._tune_cache = argv[++i];
+        else if (!std::strcmp(argv[i], "--no-tune-cache"))
+            engine._tune_cache = nullptr;
+        else if (!std::strcmp(argv[i], "--retune"))
+            engine._retune = true;
+        else if (!std::strcmp(argv[i], "--pipeline-cache") && i + 1 < argc)
+            engine._pipeline_cache_path = argv[++i];
+        else if (!std::strcmp(argv[i], "--no-pipeline-cache"))
+            engine._pipeline_cache_path = nullptr;
+        else if (!std::strcmp(argv[i], "--scene") && i + 1 < argc)
+            engine._scene = argv[++i];
+        else if (!std::strcmp(argv[i], "--bindless"))
+            engine._bindless = true;
+        else if (!std::strcmp(argv[i], "--indirect"))
+            engine._indirect = engine._bindless = true;
+        else if (!std::strcmp(argv[i], "--no-cull"))
+            engine._cull = false;
+        else if (!std::strcmp(argv[i], "--occlusion"))
+            engine._occlusion = engine._indirect = engine._bindless = true;
+        else if (!std::strcmp(argv[i], "--output") && i + 1 < argc) {
+            output = argv[++i];
+            engine._readback = true;
+        }
+    }
+
+    /* the occlusion test is the second half of the cull pass */
+    if (!engine._cull)
+        engine._occlusion = false;
+
     engine.init();
     engine.run();
+
+    std::vector<unsigned char> pixels;
+    if (output && engine.read_target(pixels))
+        write_ppm(output, engine._resolution, pixels);
+
     engine.cleanup();
     return 0;
 }
+#endif
 
 /*
     Each of the functions below initialize a compute shader
@@ -85,7 +226,12 @@ int main(int argc, char *argv[])
         pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
             VK_SHADER_STAGE_COMPUTE_BIT, compute_shader_example.module));
 
-        pb.build_comp(...);
+        compute_shader_example.pipeline = _compiles.build_comp(pb, ...);
+
+    The pipeline compiles on a worker thread and pipeline points at where it lands. All
+    of them are there once init returns, a submit during init waits on its own first.
+
+        _compiles.wait(compute_shader_example.pipeline);
 
     Finally, add draw commands. At this point, you have mutiple options, you have to run
     cc_init(...) the first time. After that, you could push_back(...) to have it executed
@@ -102,15 +248,23 @@ int main(int argc, char *argv[])
         cs::push_back(compute_shader_example);
         cs::comp_immediate_submit(_device, _comp_queue, &compute_shader_example);
 
+    Setting async on a pushed cs records it on _comp_queue instead, when that is a
+    family of its own. Images it writes are listed in outputs, they are handed
+    back to the graphics queue before the remaining passes run.
+
+        compute_shader_example.async = true;
+        compute_shader_example.outputs = { img_name };
+
 */
 
 void vk_engine::comp_init()
 {
     comp_allocator allocator(_device, _allocator);
 
-    allocator.create_buffer(pad_uniform_buffer_size(sizeof(camera_data)),
-                            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, "camera");
+    /* per-frame uniforms live in the ring, bound at this frame's offset */
+    allocator.load_buffer("camera", _uniforms.view(sizeof(camera_data)));
+    allocator.load_buffer("camera_prev", _uniforms.view(sizeof(camera_data)));
+    allocator.load_buffer("cloud", _uniforms.view(sizeof(cloud_data)));
 
     allocator.create_buffer(pad_uniform_buffer_size(sizeof(glm::vec2)),
                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
@@ -130,9 +284,25 @@ void vk_engine::comp_init()
 
     allocator.load_img("target", _target);
 
+    if (!_cloud_scale)
+        _cloud_scale = 1;
+
     cloudtex_init();
     weather_init();
+    light_init();
     cloud_init();
+
+    if (_temporal)
+        temporal_init();
+
+    if (_cloud_scale > 1)
+        upsample_init();
+
+    if (_scene && _indirect && _cull && _draw_count)
+        cull_init();
+
+    if (_scene && _occlusion && _draw_count)
+        occlusion_init();
 }
 
 void vk_engine::cloudtex_init()
@@ -140,10 +310,22 @@ void vk_engine::cloudtex_init()
     /* initializing compute shader */
     comp_allocator allocator(_device, _allocator);
 
-    allocator.create_img(VK_FORMAT_R16G16B16A16_SFLOAT,
-                         VkExtent3D{cloudtex_size, cloudtex_size, cloudtex_size},
-                         VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_USAGE_STORAGE_BIT, 0,
-                         "cloudtex");
+    VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    VkExtent3D extent = VkExtent3D{_cloudtex_size, _cloudtex_size, _cloudtex_size};
+    uint32_t mip_levels = _sampled ? mip_count(_cloudtex_size) : 1;
+
+    /* transfer either way, it is uploaded from or read back into the cache */
+    allocator.create_img(format, extent, VK_IMAGE_ASPECT_COLOR_BIT,
+                         _sampled ? sampled_usage
+                                  : VK_IMAGE_USAGE_STORAGE_BIT |
+                                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                        VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                         0, "cloudtex", mip_levels);
+
+    /* written once, read only from the first frame on */
+    if (_sampled)
+        allocator.create_sampler("cloudtex", mip_levels,
+                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
     allocator.create_buffer(pad_uniform_buffer_size(sizeof(float)),
                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
@@ -151,18 +333,24 @@ void vk_engine::cloudtex_init()
 
     allocated_buffer buffer = allocator.get_buffer("size");
 
-    float dummy = (float)cloudtex_size;
+    float dummy = (float)_cloudtex_size;
 
     void *data;
     vmaMapMemory(_allocator, buffer.allocation, &data);
     std::memcpy(data, (float *)&dummy, sizeof(float));
     vmaUnmapMemory(_allocator, buffer.allocation);
 
+    /* one vec4 a cell, shared by every octave that fits */
+    allocator.create_buffer(
+        (VkDeviceSize)worley_cells * worley_cells * worley_cells * 4 * sizeof(float),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0, "worley_points");
+
     /* match set binding */
     std::vector<descriptor> descriptors = {
         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "cloudtex"},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "extent"},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "size"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "worley_points"},
     };
     
     constexpr uint32_t kCloudTexSpv[] = {
@@ -170,8 +358,21 @@ void vk_engine::cloudtex_init()
 	};
 
     cs cloudtex(allocator, descriptors, kCloudTexSpv, sizeof(kCloudTexSpv), _min_buffer_alignment);
+    cloudtex.name = "cloudtex";
+
+    std::vector<descriptor> points_descriptors = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "worley_points"},
+    };
+
+    constexpr uint32_t kWorleyPointsSpv[] = {
+#include <shader/worley_points.comp.u32>
+	};
+
+    cs points(allocator, points_descriptors, kWorleyPointsSpv, sizeof(kWorleyPointsSpv),
+              _min_buffer_alignment);
+    points.name = "worley_points";
 
-    /* build pipeline */
+    /* build pipeline, it compiles while the cache is read and uploaded */
     PipelineBuilder pb = {};
     pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
         VK_SHADER_STAGE_COMPUTE_BIT, cloudtex.module));
@@ -185,36 +386,174 @@ void vk_engine::cloudtex_init()
 
     std::vector<VkDescriptorSetLayout> layouts = { cloudtex.layout };
 
-    pb.build_comp(_device, layouts, push_constants, &cloudtex.pipeline_layout,
-                  &cloudtex.pipeline);
+    cloudtex.pipeline = _compiles.build_comp(pb, _device, layouts, push_constants,
+                                             &cloudtex.pipeline_layout);
+
+    PipelineBuilder points_pb = {};
+    points_pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
+        VK_SHADER_STAGE_COMPUTE_BIT, points.module));
+
+    std::vector<VkPushConstantRange> points_push_constants = {};
+    std::vector<VkDescriptorSetLayout> points_layouts = { points.layout };
+
+    points.pipeline =
+        _compiles.build_comp(points_pb, _device, points_layouts, points_push_constants,
+                             &points.pipeline_layout);
+
+    /* the volume only depends on the shaders, its size and its format */
+    uint64_t key = vk_cache::fnv1a(kCloudTexSpv, sizeof(kCloudTexSpv));
+    key = vk_cache::fnv1a(kWorleyPointsSpv, sizeof(kWorleyPointsSpv), key);
+    key = vk_cache::fnv1a(&_cloudtex_size, sizeof(uint32_t), key);
+    key = vk_cache::fnv1a(&format, sizeof(VkFormat), key);
+
+    /* level 0 only, 8 bytes a texel, mips are rebuilt from it */
+    size_t size = (size_t)_cloudtex_size * _cloudtex_size * _cloudtex_size * 8;
+
+    std::vector<char> texels;
+    bool cached = _noise_cache && vk_cache::read(_noise_cache, key, texels) &&
+                  texels.size() == size;
+
+    allocated_buffer staging_buffer = {};
+
+    /* not through create_buffer, it is gone before cleanup */
+    if (_noise_cache) {
+        VkBufferCreateInfo staging_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+        staging_info.size = size;
+        staging_info.usage =
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        VmaAllocationCreateInfo vma_allocation_info = {};
+        vma_allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+        vma_allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+
+        VK_CHECK(vmaCreateBuffer(_allocator, &staging_info, &vma_allocation_info,
+                                 &staging_buffer.buffer, &staging_buffer.allocation,
+                                 nullptr));
+        staging_buffer.size = size;
+    }
+
+    if (cached) {
+        void *data;
+        vmaMapMemory(_allocator, staging_buffer.allocation, &data);
+        std::memcpy(data, texels.data(), size);
+        vmaUnmapMemory(_allocator, staging_buffer.allocation);
+    }
+
+    VkPipeline *points_pipeline = points.pipeline;
+    VkPipelineLayout points_pipeline_layout = points.pipeline_layout;
+    VkDescriptorSet points_set = points.set;
 
     cloudtex.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
-        vk_cmd::vk_img_layout_transition(cbuffer, cs->allocator.get_img("cloudtex").img,
-                                         VK_IMAGE_LAYOUT_UNDEFINED,
-                                         VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+        VkImage img = cs->allocator.get_img("cloudtex").img;
 
-        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cs->pipeline);
+        if (cached) {
+            vk_cmd::vk_img_layout_transition(cbuffer, img, VK_IMAGE_LAYOUT_UNDEFINED,
+                                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                             _comp_index);
 
-        std::vector<uint32_t> doffsets = { 0, 0, };
+            VkBufferImageCopy region = vk_boiler::buffer_img_copy(extent);
+            vkCmdCopyBufferToImage(cbuffer, staging_buffer.buffer, img,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-        vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                                cs->pipeline_layout, 0, 1, &cs->set, doffsets.size(),
-                                doffsets.data());
+            vk_cmd::vk_img_layout_transition(cbuffer, img,
+                                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                             VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+        } else {
+            vk_cmd::vk_img_layout_transition(cbuffer, img, VK_IMAGE_LAYOUT_UNDEFINED,
+                                             VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+
+            /* feature points first, cloudtex.comp reads them instead of hashing */
+            vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *points_pipeline);
+
+            vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    points_pipeline_layout, 0, 1, &points_set, 0,
+                                    nullptr);
+
+            vkCmdDispatch(cbuffer, worley_cells / 8, worley_cells / 8, worley_cells / 8);
+
+            vk_cmd::vk_buffer_barrier(cbuffer,
+                                      cs->allocator.get_buffer("worley_points").buffer);
+
+            vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+            std::vector<uint32_t> doffsets = { 0, 0, };
+
+            vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    cs->pipeline_layout, 0, 1, &cs->set, doffsets.size(),
+                                    doffsets.data());
+
+            vkCmdDispatch(cbuffer, _cloudtex_size / 8, _cloudtex_size / 8,
+                          _cloudtex_size / 8);
+
+            /* read back for the cache, in the same submit */
+            if (staging_buffer.buffer) {
+                vk_cmd::vk_img_layout_transition(cbuffer, img, VK_IMAGE_LAYOUT_GENERAL,
+                                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                 _comp_index);
 
-        vkCmdDispatch(cbuffer, cloudtex_size / 8, cloudtex_size / 8, cloudtex_size / 8);
+                vk_cmd::vk_img_buffer_copy(cbuffer, extent, img, staging_buffer.buffer);
+
+                vk_cmd::vk_img_layout_transition(cbuffer, img,
+                                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                 VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+            }
+        }
+
+        /* written once on _comp_queue, sampled by cloud on the graphics queue */
+        ownership_transfer transfer = {};
+        transfer.img = cs->allocator.get_img("cloudtex").img;
+        transfer.old_layout = VK_IMAGE_LAYOUT_GENERAL;
+        transfer.new_layout = VK_IMAGE_LAYOUT_GENERAL;
+        transfer.src_index = _comp_index;
+        release(cbuffer, transfer);
     };
 
+    /* an upload from the cache never binds them */
+    if (!cached) {
+        _compiles.wait(cloudtex.pipeline);
+        _compiles.wait(points.pipeline);
+    }
+
     cs::cc_init(_comp_index, _device);
     cs::comp_immediate_submit(_device, _comp_queue, &cloudtex);
+
+    if (_noise_cache && !cached) {
+        void *data;
+        vmaMapMemory(_allocator, staging_buffer.allocation, &data);
+        vmaInvalidateAllocation(_allocator, staging_buffer.allocation, 0, VK_WHOLE_SIZE);
+        vk_cache::write(_noise_cache, key, data, size);
+        vmaUnmapMemory(_allocator, staging_buffer.allocation);
+    }
+
+    if (_noise_cache)
+        vmaDestroyBuffer(_allocator, staging_buffer.buffer, staging_buffer.allocation);
+
+    if (_sampled)
+        _mip_builds.push_back(mip_build{allocator.get_img("cloudtex").img, extent,
+                                        mip_levels,
+                                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
 }
 
 void vk_engine::weather_init()
 {
     comp_allocator allocator(_device, _allocator);
 
-    allocator.create_img(VK_FORMAT_R16_SFLOAT, VkExtent3D{weather_size, weather_size, 1},
-                         VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_USAGE_STORAGE_BIT, 0,
-                         "weather");
+    uint32_t size = _weather_cache ? weather_cache_scale * _weather_size : _weather_size;
+    uint32_t mip_levels = _sampled ? mip_count(size) : 1;
+
+    allocator.create_img(VK_FORMAT_R16_SFLOAT, VkExtent3D{size, size, 1},
+                         VK_IMAGE_ASPECT_COLOR_BIT,
+                         _sampled ? sampled_usage
+                                  : VK_IMAGE_USAGE_STORAGE_BIT |
+                                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                         0, "weather", mip_levels);
+
+    /* rewritten on compute every frame, sampled in general instead of moving back */
+    if (_sampled)
+        allocator.create_sampler("weather", mip_levels, VK_IMAGE_LAYOUT_GENERAL);
+
+    mip_build mips = {allocator.get_img("weather").img, VkExtent3D{size, size, 1},
+                      mip_levels, VK_IMAGE_LAYOUT_GENERAL};
 
     std::vector<descriptor> descriptors = {
         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "weather"},
@@ -227,139 +566,818 @@ void vk_engine::weather_init()
 
     cs weather(allocator, descriptors, kWeatherSpv, sizeof(kWeatherSpv),
                _min_buffer_alignment);
+    weather.name = "weather";
+    weather.async = true;
+    weather.outputs = { "weather" };
 
     PipelineBuilder pb = {};
     pb._shader_stage_infos.push_back(
         vk_boiler::shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, weather.module));
 
-    VkPushConstantRange u_time = {};
-    u_time.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    u_time.offset = 0;
-    u_time.size = sizeof(float);
+    VkPushConstantRange u_weather = {};
+    u_weather.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    u_weather.offset = 0;
+    u_weather.size = sizeof(weather_data);
 
-    std::vector<VkPushConstantRange> push_constants = { u_time };
+    std::vector<VkPushConstantRange> push_constants = { u_weather };
 
     std::vector<VkDescriptorSetLayout> layouts = { weather.layout };
 
-    pb.build_comp(_device, layouts, push_constants, &weather.pipeline_layout,
-                  &weather.pipeline);
+    vk_tune::workgroup group = vk_tune::DEFAULT_GROUP;
+
+    std::vector<uint32_t> constants = {group.x, group.y, _weather_octaves};
+
+    weather.pipeline = _compiles.build_comp(pb, _device, layouts, push_constants,
+                                            &weather.pipeline_layout, constants);
+
+    if (!_weather_cache) {
+        weather.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+            vk_cmd::vk_img_layout_transition(
+                cbuffer, cs->allocator.get_img("weather").img, VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+
+            vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+            uint32_t doffset = 0;
+            vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    cs->pipeline_layout, 0, 1, &cs->set, 1, &doffset);
+
+            weather_data u_weather = { glm::ivec2(0), _time, 0 };
+            vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                               0, sizeof(weather_data), &u_weather);
+
+            vkCmdDispatch(cbuffer, (size + group.x - 1) / group.x,
+                          (size + group.y - 1) / group.y, 1);
+            _weather_version++;
+
+            if (_sampled)
+                _mip_builds.push_back(mips);
+        };
+
+        css.push_back(weather);
+        return;
+    }
 
+    /* the whole periodic map once, cc is already set up by cloudtex_init */
     weather.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
         vk_cmd::vk_img_layout_transition(cbuffer, cs->allocator.get_img("weather").img,
                                          VK_IMAGE_LAYOUT_UNDEFINED,
                                          VK_IMAGE_LAYOUT_GENERAL, _comp_index);
 
-        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cs->pipeline);
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
 
         uint32_t doffset = 0;
         vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                                 cs->pipeline_layout, 0, 1, &cs->set, 1, &doffset);
 
-        float u_time = SDL_GetTicks() / 1000.f;
+        weather_data u_weather = { glm::ivec2(0), 0.f, weather_period };
         vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
-                           sizeof(float), &u_time);
+                           sizeof(weather_data), &u_weather);
 
-        vkCmdDispatch(cbuffer, weather_size / 8, weather_size / 8, 1);
+        vkCmdDispatch(cbuffer, (size + group.x - 1) / group.x,
+                      (size + group.y - 1) / group.y, 1);
+    };
+
+    _compiles.wait(weather.pipeline);
+    cs::comp_immediate_submit(_device, _comp_queue, &weather);
+
+    /* from here on only a few tiles a frame, the map stays on the compute family */
+    weather.persistent = true;
+    weather.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+        /* same speed the regenerated map used to slide at, in texels */
+        float scroll = std::fmod(_time * .06f * size / weather_period, (float)size);
+        _cloud_data.weather_offset = glm::vec2(scroll);
+        _cloud_data.weather_wrap = 1;
+
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+        uint32_t doffset = 0;
+        vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                cs->pipeline_layout, 0, 1, &cs->set, 1, &doffset);
+
+        uint32_t tiles_x = size / weather_tile;
+        uint32_t count = tiles_x * tiles_x;
+
+        for (uint32_t i = 0; i < std::min(_weather_tiles, count); ++i) {
+            /* tiles of one sweep share a time, so seams only shift once a sweep */
+            if (!_weather_tile)
+                _weather_epoch = _time;
+
+            glm::ivec2 offset =
+                glm::ivec2(_weather_tile % tiles_x, _weather_tile / tiles_x);
+            weather_data u_weather = { offset * (int)weather_tile, _weather_epoch,
+                                       weather_period };
+            vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                               0, sizeof(weather_data), &u_weather);
+
+            vkCmdDispatch(cbuffer, weather_tile / group.x, weather_tile / group.y, 1);
+
+            _weather_tile = (_weather_tile + 1) % count;
+        }
+
+        /* scrolled or refreshed, either way light has to follow */
+        _weather_version++;
+
+        if (_sampled)
+            _mip_builds.push_back(mips);
     };
 
     css.push_back(weather);
 }
 
+void vk_engine::light_init()
+{
+    comp_allocator allocator(_device, _allocator);
+
+    allocator.create_img(VK_FORMAT_R16_SFLOAT, light_extent, VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_USAGE_STORAGE_BIT, 0, "light");
+
+    VkDescriptorType noise = _sampled ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                                      : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+    std::vector<descriptor> descriptors = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "light"},
+        {noise, "cloudtex"},
+        {noise, "weather"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "cloud"},
+    };
+
+    constexpr uint32_t kLightSpv[] = {
+#include <shader/light.comp.u32>
+	};
+
+    constexpr uint32_t kLightSampledSpv[] = {
+#include <shader/light_sampled.comp.u32>
+	};
+
+    cs light(allocator, descriptors, _sampled ? kLightSampledSpv : kLightSpv,
+             _sampled ? sizeof(kLightSampledSpv) : sizeof(kLightSpv),
+             _min_buffer_alignment);
+    light.name = "light";
+    light.outputs = { "light" };
+
+    PipelineBuilder pb = {};
+    pb._shader_stage_infos.push_back(
+        vk_boiler::shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, light.module));
+
+    VkPushConstantRange u_light = {};
+    u_light.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    u_light.offset = 0;
+    u_light.size = sizeof(light_data);
+
+    std::vector<VkPushConstantRange> push_constants = { u_light };
+
+    std::vector<VkDescriptorSetLayout> layouts = { light.layout };
+
+    std::vector<uint32_t> constants = {light_group.x, light_group.y, light_slab,
+                                       _light_steps};
+
+    light.pipeline = _compiles.build_comp(pb, _device, layouts, push_constants,
+                                          &light.pipeline_layout, constants);
+
+    light.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+        bool rebuild = !_light_valid || light_changed(_light_cloud, _cloud_data);
+
+        /* nothing it depends on moved, last frame's volume still holds */
+        if (!rebuild && _light_version == _weather_version)
+            return;
+
+        if (!_light_valid)
+            vk_cmd::vk_img_layout_transition(cbuffer, cs->allocator.get_img("light").img,
+                                             VK_IMAGE_LAYOUT_UNDEFINED,
+                                             VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+        /* cloud pushes it again later this frame, weather may move it in between */
+        uint32_t doffset = _uniforms.push(&_cloud_data, sizeof(cloud_data));
+        vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                cs->pipeline_layout, 0, 1, &cs->set, 1, &doffset);
+
+        uint32_t count = light_extent.depth / light_slab;
+        uint32_t slabs = rebuild ? count : std::min(_light_slabs, count);
+
+        /* slabs wrapping around the end go out as a second dispatch */
+        uint32_t first = rebuild ? 0 : _light_slab;
+        while (slabs) {
+            uint32_t n = std::min(slabs, count - first);
+
+            light_data u_light = { (int)(first * light_slab) };
+            vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                               0, sizeof(light_data), &u_light);
+
+            vkCmdDispatch(cbuffer, light_extent.width / light_group.x,
+                          light_extent.height / light_group.y, n);
+
+            first = (first + n) % count;
+            slabs -= n;
+        }
+
+        _light_slab = first;
+        _light_cloud = _cloud_data;
+        _light_version = _weather_version;
+        _light_valid = true;
+    };
+
+    css.push_back(light);
+}
+
 void vk_engine::cloud_init()
 {
     comp_allocator allocator(_device, _allocator);
 
-    allocator.create_buffer(pad_uniform_buffer_size(sizeof(cloud_data)),
-                            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, "cloud");
-
-    cloud_data.type = .6f;
-    cloud_data.freq = .2f;
-    cloud_data.ambient = 1.f;
-    cloud_data.sigma_a = 0.f;
-    cloud_data.sigma_s = .6f;
-    cloud_data.step = .4f;
-    cloud_data.max_steps = 96;
-    cloud_data.cutoff = .3f;
-    cloud_data.density = 1.f;
-    cloud_data.sun_color = glm::vec3(.99f, .36f, .32f);
-    cloud_data.sky_color = glm::vec3(.98f, .83f, .64f);
+    /*
+        temporal traces one pixel per block, a _cloud_scale above 1 traces a
+        lower resolution grid, either goes into cloud_sample, otherwise target
+    */
+    bool raw = _temporal || _cloud_scale > 1;
+    uint32_t stride = _temporal ? temporal_stride : 1;
+    uint32_t width = (_resolution.width + _cloud_scale - 1) / _cloud_scale;
+    uint32_t height = (_resolution.height + _cloud_scale - 1) / _cloud_scale;
+    VkExtent3D extent =
+        VkExtent3D{(width + stride - 1) / stride, (height + stride - 1) / stride, 1};
+
+    allocator.create_img(VK_FORMAT_R32_SFLOAT, extent, VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_USAGE_STORAGE_BIT, 0, "cloud_depth");
+
+    if (raw)
+        allocator.create_img(VK_FORMAT_R16G16B16A16_SFLOAT, extent,
+                             VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_USAGE_STORAGE_BIT, 0,
+                             "cloud_sample");
+
+    VkDescriptorType noise = _sampled ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                                      : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 
     std::vector<descriptor> descriptors = {
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "target"},
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "cloudtex"},
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "weather"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, raw ? "cloud_sample" : "target"},
+        {noise, "cloudtex"},
+        {noise, "weather"},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "extent"},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "camera"},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "cloud"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "cloud_depth"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "light"},
     };
     
     constexpr uint32_t kCloudSpv[] = {
 #include <shader/cloud.comp.u32>
 	};
+
+    constexpr uint32_t kCloudSampledSpv[] = {
+#include <shader/cloud_sampled.comp.u32>
+	};
     
-    cs cloud(allocator, descriptors, kCloudSpv, sizeof(kCloudSpv), _min_buffer_alignment);
+    const uint32_t *spv = _sampled ? kCloudSampledSpv : kCloudSpv;
+    uint32_t spv_size = _sampled ? sizeof(kCloudSampledSpv) : sizeof(kCloudSpv);
+
+    cs cloud(allocator, descriptors, spv, spv_size, _min_buffer_alignment);
+    cloud.name = "cloud";
+
+    if (raw)
+        cloud.outputs = { "cloud_sample", "cloud_depth" };
 
     PipelineBuilder pb = {};
     pb._shader_stage_infos.push_back(
         vk_boiler::shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cloud.module));
 
-    std::vector<VkPushConstantRange> push_constants = {};
+    VkPushConstantRange u_trace = {};
+    u_trace.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    u_trace.offset = 0;
+    u_trace.size = sizeof(trace_data);
+
+    std::vector<VkPushConstantRange> push_constants = { u_trace };
 
     std::vector<VkDescriptorSetLayout> layouts = { cloud.layout };
 
-    pb.build_comp(_device, layouts, push_constants, &cloud.pipeline_layout,
-                  &cloud.pipeline);
+    /* the fastest shape depends on the shader and how many groups there are */
+    uint64_t key = vk_cache::fnv1a(spv, spv_size);
+    key = vk_cache::fnv1a(&extent, sizeof(VkExtent3D), key);
+    _cloud_tuner.init(_physical_device, _tune_cache, "cloud", key, _retune,
+                      _profiler.enabled);
+
+    /* every candidate while tuning, only the workgroup constants differ */
+    pb.build_layout(_device, layouts, push_constants, &cloud.pipeline_layout);
+
+    std::vector<VkPipeline *> pipelines(_cloud_tuner.groups.size());
+    for (uint32_t i = 0; i < pipelines.size(); ++i) {
+        vk_tune::workgroup group = _cloud_tuner.groups[i];
+        pipelines[i] =
+            _compiles.create_comp(pb, cloud.pipeline_layout, {group.x, group.y});
+    }
+
+    cloud.pipeline = pipelines[0];
 
     cloud.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
-        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cs->pipeline);
+        _cloud_tuner.update(_profiler, _tune_cache);
+        uint32_t variant = _cloud_tuner.pick(_frame_number);
+        vk_tune::workgroup group = _cloud_tuner.groups[variant];
 
-        camera_data camera_data;
-        camera_data.pos = _vk_camera.get_pos();
-        camera_data.dir = _vk_camera.get_dir();
-        camera_data.up = _vk_camera.get_up();
-        camera_data.fov = _vk_camera.get_fov();
+        /* rewritten in full every frame */
+        vk_cmd::vk_img_layout_transition(
+            cbuffer, cs->allocator.get_img("cloud_depth").img, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL, _comp_index);
 
-        void *data;
-        vmaMapMemory(_allocator, cs->allocator.get_buffer("camera").allocation, &data);
-        std::memcpy(data, &camera_data, pad_uniform_buffer_size(sizeof(camera_data)));
-        vmaUnmapMemory(cs->allocator.allocator,
-                       cs->allocator.get_buffer("camera").allocation);
+        if (raw)
+            vk_cmd::vk_img_layout_transition(
+                cbuffer, cs->allocator.get_img("cloud_sample").img,
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *pipelines[variant]);
+
+        _camera_data.pos = _vk_camera.get_pos();
+        _camera_data.dir = _vk_camera.get_dir();
+        _camera_data.up = _vk_camera.get_up();
+        _camera_data.fov = _vk_camera.get_fov();
 
-        vmaMapMemory(_allocator, cs->allocator.get_buffer("cloud").allocation, &data);
-        std::memcpy(data, &cloud_data, pad_uniform_buffer_size(sizeof(cloud_data)));
-        vmaUnmapMemory(cs->allocator.allocator,
-                       cs->allocator.get_buffer("cloud").allocation);
+        /* temporal and upsample bind the same copies later this frame */
+        _camera_offset = _uniforms.push(&_camera_data, sizeof(camera_data));
+        _cloud_offset = _uniforms.push(&_cloud_data, sizeof(cloud_data));
 
-        std::vector<uint32_t> doffsets = { 0, 0, 0 };
+        std::vector<uint32_t> doffsets = { 0, _camera_offset, _cloud_offset };
         vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                                 cs->pipeline_layout, 0, 1, &cs->set, doffsets.size(),
                                 doffsets.data());
 
-        vkCmdDispatch(cbuffer, _resolution.width / 8, _resolution.height / 8, 1);
+        trace_data u_trace = {};
+        u_trace.jitter = _temporal ? bayer[_frame_number % 16] : glm::ivec2(0);
+        u_trace.stride = stride;
+        u_trace.raw = raw;
+        u_trace.scale = _cloud_scale;
+        vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(trace_data), &u_trace);
+
+        /* timed on its own while tuning, the pass total mixes the candidates */
+        uint32_t query = _cloud_tuner.tuning
+                             ? _profiler.begin(cbuffer, _cloud_tuner.label(variant))
+                             : UINT32_MAX;
+
+        vkCmdDispatch(cbuffer, (extent.width + group.x - 1) / group.x,
+                      (extent.height + group.y - 1) / group.y, 1);
+
+        _profiler.end(cbuffer, query);
     };
 
     css.push_back(cloud);
 }
 
+void vk_engine::temporal_init()
+{
+    comp_allocator allocator(_device, _allocator);
+
+    /* at the resolution cloud traces, upsample reads it from there when lower */
+    VkExtent3D extent =
+        VkExtent3D{(_resolution.width + _cloud_scale - 1) / _cloud_scale,
+                   (_resolution.height + _cloud_scale - 1) / _cloud_scale, 1};
+
+    /* ping-pong, one is read while the other is written */
+    std::vector<std::string> histories = { "history0", "history1" };
+    std::vector<std::string> history_depths = { "history_depth0", "history_depth1" };
+
+    for (std::string &name : histories)
+        allocator.create_img(VK_FORMAT_R16G16B16A16_SFLOAT, extent,
+                             VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_USAGE_STORAGE_BIT, 0,
+                             name);
+
+    for (std::string &name : history_depths)
+        allocator.create_img(VK_FORMAT_R32_SFLOAT, extent, VK_IMAGE_ASPECT_COLOR_BIT,
+                             VK_IMAGE_USAGE_STORAGE_BIT, 0, name);
+
+    std::vector<descriptor> descriptors = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "target"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "cloud_sample"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "cloud_depth"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "history0"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "history1"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "history_depth0"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "history_depth1"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "extent"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "camera"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "camera_prev"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "cloud"},
+    };
+
+    constexpr uint32_t kTemporalSpv[] = {
+#include <shader/temporal.comp.u32>
+	};
+
+    cs temporal(allocator, descriptors, kTemporalSpv, sizeof(kTemporalSpv),
+                _min_buffer_alignment);
+    temporal.name = "temporal";
+    temporal.outputs = { "history0", "history1", "history_depth0", "history_depth1" };
+
+    PipelineBuilder pb = {};
+    pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
+        VK_SHADER_STAGE_COMPUTE_BIT, temporal.module));
+
+    VkPushConstantRange u_temporal = {};
+    u_temporal.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    u_temporal.offset = 0;
+    u_temporal.size = sizeof(temporal_data);
+
+    std::vector<VkPushConstantRange> push_constants = { u_temporal };
+
+    std::vector<VkDescriptorSetLayout> layouts = { temporal.layout };
+
+    vk_tune::workgroup group = vk_tune::DEFAULT_GROUP;
+
+    temporal.pipeline =
+        _compiles.build_comp(pb, _device, layouts, push_constants,
+                             &temporal.pipeline_layout, {group.x, group.y});
+
+    temporal.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+        /* nothing to reproject yet, start both histories from scratch */
+        if (!_history_valid)
+            for (const std::string &name : cs->outputs)
+                vk_cmd::vk_img_layout_transition(
+                    cbuffer, cs->allocator.get_img(name).img, VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_IMAGE_LAYOUT_GENERAL, _comp_index);
+
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+        /* cloud already pushed this frame's camera */
+        uint32_t prev_offset = _uniforms.push(&_camera_prev, sizeof(camera_data));
+
+        _camera_prev = _camera_data;
+
+        std::vector<uint32_t> doffsets = { 0, _camera_offset, prev_offset,
+                                           _cloud_offset };
+        vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                cs->pipeline_layout, 0, 1, &cs->set, doffsets.size(),
+                                doffsets.data());
+
+        temporal_data u_temporal = {};
+        u_temporal.jitter = bayer[_frame_number % 16];
+        u_temporal.stride = temporal_stride;
+        u_temporal.parity = _frame_number % 2;
+        u_temporal.reset = !_history_valid;
+        u_temporal.scale = _cloud_scale;
+        vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(temporal_data), &u_temporal);
+
+        vkCmdDispatch(cbuffer, (extent.width + group.x - 1) / group.x,
+                      (extent.height + group.y - 1) / group.y, 1);
+
+        _history_valid = true;
+    };
+
+    css.push_back(temporal);
+}
+
+void vk_engine::upsample_init()
+{
+    comp_allocator allocator(_device, _allocator);
+
+    /* temporal leaves its result in the history written this frame */
+    std::vector<descriptor> descriptors = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "target"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _temporal ? "history0" : "cloud_sample"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _temporal ? "history1" : "cloud_sample"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _temporal ? "history_depth0" : "cloud_depth"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _temporal ? "history_depth1" : "cloud_depth"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "extent"},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "cloud"},
+    };
+
+    constexpr uint32_t kUpsampleSpv[] = {
+#include <shader/upsample.comp.u32>
+	};
+
+    cs upsample(allocator, descriptors, kUpsampleSpv, sizeof(kUpsampleSpv),
+                _min_buffer_alignment);
+    upsample.name = "upsample";
+
+    PipelineBuilder pb = {};
+    pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
+        VK_SHADER_STAGE_COMPUTE_BIT, upsample.module));
+
+    VkPushConstantRange u_upsample = {};
+    u_upsample.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    u_upsample.offset = 0;
+    u_upsample.size = sizeof(upsample_data);
+
+    std::vector<VkPushConstantRange> push_constants = { u_upsample };
+
+    std::vector<VkDescriptorSetLayout> layouts = { upsample.layout };
+
+    vk_tune::workgroup group = vk_tune::DEFAULT_GROUP;
+
+    upsample.pipeline =
+        _compiles.build_comp(pb, _device, layouts, push_constants,
+                             &upsample.pipeline_layout, {group.x, group.y});
+
+    upsample.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+        std::vector<uint32_t> doffsets = { 0, _cloud_offset };
+        vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                cs->pipeline_layout, 0, 1, &cs->set, doffsets.size(),
+                                doffsets.data());
+
+        /* temporal ran before in this frame and wrote history _frame_number % 2 */
+        upsample_data u_upsample = {};
+        u_upsample.scale = _cloud_scale;
+        u_upsample.parity = _temporal ? _frame_number % 2 : 0;
+        vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(upsample_data), &u_upsample);
+
+        vkCmdDispatch(cbuffer, (_resolution.width + group.x - 1) / group.x,
+                      (_resolution.height + group.y - 1) / group.y, 1);
+    };
+
+    css.push_back(upsample);
+}
+
+void vk_engine::cull_init()
+{
+    comp_allocator allocator(_device, _allocator);
+
+    allocator.load_buffer("draw_data", _draw_data);
+    allocator.load_buffer("draw_bounds", _draw_bounds);
+    allocator.load_buffer("draw_commands", _draw_commands);
+    allocator.load_buffer("visible_commands", _visible_commands);
+    allocator.load_buffer("visible_count", _visible_count);
+
+    std::vector<descriptor> descriptors = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_data"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_bounds"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_commands"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "visible_commands"},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "visible_count"},
+    };
+
+    /* with occlusion this is the early phase, only what was visible last frame */
+    if (_occlusion) {
+        allocator.load_buffer("draw_visibility", _draw_visibility);
+        descriptors.push_back({VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_visibility"});
+    }
+
+    constexpr uint32_t kCullSpv[] = {
+#include <shader/cull.comp.u32>
+	};
+    constexpr uint32_t kCullEarlySpv[] = {
+#include <shader/cull_early.comp.u32>
+	};
+
+    cs cull = _occlusion ? cs(allocator, descriptors, kCullEarlySpv,
+                              sizeof(kCullEarlySpv), _min_buffer_alignment)
+                         : cs(allocator, descriptors, kCullSpv, sizeof(kCullSpv),
+                              _min_buffer_alignment);
+    cull.name = "cull";
+
+    PipelineBuilder pb = {};
+    pb._shader_stage_infos.push_back(
+        vk_boiler::shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cull.module));
+
+    VkPushConstantRange u_cull = {};
+    u_cull.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    u_cull.offset = 0;
+    u_cull.size = sizeof(cull_data);
+
+    std::vector<VkPushConstantRange> push_constants = { u_cull };
+
+    std::vector<VkDescriptorSetLayout> layouts = { cull.layout };
+
+    cull.pipeline =
+        _compiles.build_comp(pb, _device, layouts, push_constants, &cull.pipeline_layout);
+
+    cull.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+        /* the previous frame's draw is done reading the count and commands */
+        vk_cmd::vk_buffer_barrier(cbuffer, _visible_count.buffer);
+        vkCmdFillBuffer(cbuffer, _visible_count.buffer, 0, sizeof(uint32_t), 0);
+        vk_cmd::vk_buffer_barrier(cbuffer, _visible_count.buffer);
+
+        vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+        vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                cs->pipeline_layout, 0, 1, &cs->set, 0, nullptr);
+
+        cull_data u_cull = {};
+        _vk_camera.get_frustum(u_cull.planes);
+        u_cull.draw_count = _draw_count;
+        vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(cull_data), &u_cull);
+
+        vkCmdDispatch(cbuffer, (_draw_count + 63) / 64, 1, 1);
+
+        /* visible to the indirect draw later in this command buffer */
+        vk_cmd::vk_buffer_barrier(cbuffer, _visible_commands.buffer);
+        vk_cmd::vk_buffer_barrier(cbuffer, _visible_count.buffer);
+    };
+
+    css.push_back(cull);
+}
+
+void vk_engine::occlusion_init()
+{
+    comp_allocator allocator(_device, _allocator);
+
+    /* the largest power of two inside the frame, every level halves evenly */
+    _pyramid_extent = {1, 1};
+    while (_pyramid_extent.width * 2 <= _resolution.width)
+        _pyramid_extent.width *= 2;
+    while (_pyramid_extent.height * 2 <= _resolution.height)
+        _pyramid_extent.height *= 2;
+
+    _pyramid_levels = mip_count(std::max(_pyramid_extent.width, _pyramid_extent.height));
+
+    allocator.create_img(VK_FORMAT_R32G32_SFLOAT,
+                         VkExtent3D{_pyramid_extent.width, _pyramid_extent.height, 1},
+                         VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 0,
+                         "depth_pyramid", _pyramid_levels);
+    allocator.create_sampler("depth_pyramid", _pyramid_levels, VK_IMAGE_LAYOUT_GENERAL);
+
+    /* only read through texelFetch, the sampler's filter never applies */
+    allocator.load_img("depth", _depth_img);
+    allocator.create_sampler("depth", 1, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+
+    allocator.load_buffer("late_commands", _late_commands);
+    allocator.load_buffer("late_count", _late_count);
+    allocator.load_buffer("draw_visibility", _draw_visibility);
+
+    { /* depth pyramid */
+        std::vector<descriptor> descriptors = {
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, "depth"},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "depth_pyramid"},
+        };
+
+        constexpr uint32_t kPyramidSpv[] = {
+#include <shader/pyramid.comp.u32>
+	};
+
+        cs pyramid(allocator, descriptors, kPyramidSpv, sizeof(kPyramidSpv),
+                   _min_buffer_alignment);
+        pyramid.name = "pyramid";
+
+        /* level i reads level i - 1, a set each, the first is the depth */
+        allocated_img img = allocator.get_img("depth_pyramid");
+        VkSampler sampler = allocator.get_sampler("depth_pyramid").sampler;
+
+        std::vector<VkDescriptorSet> level_sets = { pyramid.set };
+        for (uint32_t i = 1; i < _pyramid_levels; ++i) {
+            VkDescriptorSetLayout layout;
+            VkDescriptorSet set;
+            allocator.allocate_descriptor_set(
+                {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                 VK_DESCRIPTOR_TYPE_STORAGE_IMAGE},
+                &layout, &set);
+
+            VkDescriptorImageInfo src_info = {sampler, img.mip_views[i - 1],
+                                              VK_IMAGE_LAYOUT_GENERAL};
+            VkDescriptorImageInfo dst_info = {VK_NULL_HANDLE, img.mip_views[i],
+                                              VK_IMAGE_LAYOUT_GENERAL};
+
+            VkWriteDescriptorSet write_sets[] = {
+                vk_boiler::write_descriptor_set(
+                    &src_info, set, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+                vk_boiler::write_descriptor_set(&dst_info, set, 1,
+                                                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+            };
+
+            vkUpdateDescriptorSets(_device, 2, write_sets, 0, nullptr);
+            level_sets.push_back(set);
+        }
+
+        PipelineBuilder pb = {};
+        pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
+            VK_SHADER_STAGE_COMPUTE_BIT, pyramid.module));
+
+        VkPushConstantRange u_pyramid = {};
+        u_pyramid.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        u_pyramid.offset = 0;
+        u_pyramid.size = sizeof(pyramid_data);
+
+        std::vector<VkPushConstantRange> push_constants = { u_pyramid };
+
+        std::vector<VkDescriptorSetLayout> layouts = { pyramid.layout };
+
+        pyramid.pipeline = _compiles.build_comp(pb, _device, layouts, push_constants,
+                                                &pyramid.pipeline_layout);
+
+        pyramid.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+            /* rebuilt whole every frame */
+            vk_cmd::vk_img_layout_transition(cbuffer, img.img, VK_IMAGE_LAYOUT_UNDEFINED,
+                                             VK_IMAGE_LAYOUT_GENERAL, _gfx_index);
+
+            vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+
+            VkExtent2D src = _resolution;
+            for (uint32_t i = 0; i < _pyramid_levels; ++i) {
+                VkExtent2D dst = {std::max(_pyramid_extent.width >> i, 1u),
+                                  std::max(_pyramid_extent.height >> i, 1u)};
+
+                vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                        cs->pipeline_layout, 0, 1, &level_sets[i], 0,
+                                        nullptr);
+
+                pyramid_data u_pyramid = {};
+                u_pyramid.src_size = glm::ivec2(src.width, src.height);
+                u_pyramid.dst_size = glm::ivec2(dst.width, dst.height);
+                u_pyramid.first = i == 0;
+                vkCmdPushConstants(cbuffer, cs->pipeline_layout,
+                                   VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pyramid_data),
+                                   &u_pyramid);
+
+                vkCmdDispatch(cbuffer, (dst.width + 7) / 8, (dst.height + 7) / 8, 1);
+
+                /* the next level, or the late cull, reads this one */
+                vk_cmd::vk_img_layout_transition(cbuffer, img.img,
+                                                 VK_IMAGE_LAYOUT_GENERAL,
+                                                 VK_IMAGE_LAYOUT_GENERAL, _gfx_index);
+                src = dst;
+            }
+        };
+
+        late_css.push_back(pyramid);
+    }
+
+    { /* late phase, every draw against the pyramid */
+        std::vector<descriptor> descriptors = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_data"},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_bounds"},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_commands"},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "late_commands"},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "late_count"},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "draw_visibility"},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, "depth_pyramid"},
+        };
+
+        constexpr uint32_t kCullLateSpv[] = {
+#include <shader/cull_late.comp.u32>
+	};
+
+        cs cull_late(allocator, descriptors, kCullLateSpv, sizeof(kCullLateSpv),
+                     _min_buffer_alignment);
+        cull_late.name = "cull_late";
+
+        PipelineBuilder pb = {};
+        pb._shader_stage_infos.push_back(vk_boiler::shader_stage_create_info(
+            VK_SHADER_STAGE_COMPUTE_BIT, cull_late.module));
+
+        VkPushConstantRange u_occlusion = {};
+        u_occlusion.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        u_occlusion.offset = 0;
+        u_occlusion.size = sizeof(occlusion_data);
+
+        std::vector<VkPushConstantRange> push_constants = { u_occlusion };
+
+        std::vector<VkDescriptorSetLayout> layouts = { cull_late.layout };
+
+        cull_late.pipeline = _compiles.build_comp(pb, _device, layouts, push_constants,
+                                                  &cull_late.pipeline_layout);
+
+        cull_late.draw = [=](VkCommandBuffer cbuffer, cs *cs) {
+            vk_cmd::vk_buffer_barrier(cbuffer, _late_count.buffer);
+            vkCmdFillBuffer(cbuffer, _late_count.buffer, 0, sizeof(uint32_t), 0);
+            vk_cmd::vk_buffer_barrier(cbuffer, _late_count.buffer);
+
+            vkCmdBindPipeline(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, *cs->pipeline);
+            vkCmdBindDescriptorSets(cbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    cs->pipeline_layout, 0, 1, &cs->set, 0, nullptr);
+
+            /* the same matrix draw_indirect renders with */
+            glm::mat4 proj = _vk_camera.get_proj_mat();
+            proj[1][1] *= -1;
+
+            occlusion_data u_occlusion = {};
+            u_occlusion.view_proj = proj * _vk_camera.get_view_mat();
+            u_occlusion.pyramid_size =
+                glm::vec2(_pyramid_extent.width, _pyramid_extent.height);
+            u_occlusion.draw_count = _draw_count;
+            u_occlusion.pyramid_levels = _pyramid_levels;
+            vkCmdPushConstants(cbuffer, cs->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                               0, sizeof(occlusion_data), &u_occlusion);
+
+            vkCmdDispatch(cbuffer, (_draw_count + 63) / 64, 1, 1);
+
+            /* the late draw reads the commands, next frame's early phase the rest */
+            vk_cmd::vk_buffer_barrier(cbuffer, _late_commands.buffer);
+            vk_cmd::vk_buffer_barrier(cbuffer, _late_count.buffer);
+            vk_cmd::vk_buffer_barrier(cbuffer, _draw_visibility.buffer);
+        };
+
+        late_css.push_back(cull_late);
+    }
+}
+
 void vk_engine::draw_comp(frame *frame)
 {
     ImGui::Begin("cloud", &cloud_ui, ImGuiWindowFlags_NoResize);
-    ImGui::SetWindowSize(ImVec2(290.f, 290.f));
+    ImGui::SetWindowSize(ImVec2(290.f, 310.f));
     ImGui::Text("'tab' to toggle; 'ese' to close");
     ImGui::Text("application average %.3f ms/frame \n (%.1f FPS)",
                 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-    ImGui::SliderFloat("type", &cloud_data.type, 0.f, 1.f);
-    ImGui::SliderFloat("freq", &cloud_data.freq, 0.f, 1.f);
-    ImGui::SliderFloat("ambient", &cloud_data.ambient, 0.f, 3.f);
-    ImGui::SliderFloat("sigma_a", &cloud_data.sigma_a, 0.f, 3.f);
-    ImGui::SliderFloat("sigma_s", &cloud_data.sigma_s, 0.f, 3.f);
-    ImGui::SliderFloat("step", &cloud_data.step, .1f, 3.f);
-    ImGui::SliderInt("max_steps", &cloud_data.max_steps, 0, 128);
-    ImGui::SliderFloat("cutoff", &cloud_data.cutoff, 0.f, 1.f);
-    ImGui::SliderFloat("density", &cloud_data.density, 0.f, 3.f);
-    ImGui::ColorEdit3("sun_color", (float *)&cloud_data.sun_color);
-    ImGui::ColorEdit3("sky_color", (float *)&cloud_data.sky_color);
+    ImGui::SliderFloat("type", &_cloud_data.type, 0.f, 1.f);
+    ImGui::SliderFloat("freq", &_cloud_data.freq, 0.f, 1.f);
+    ImGui::SliderFloat("ambient", &_cloud_data.ambient, 0.f, 3.f);
+    ImGui::SliderFloat("sigma_a", &_cloud_data.sigma_a, 0.f, 3.f);
+    ImGui::SliderFloat("sigma_s", &_cloud_data.sigma_s, 0.f, 3.f);
+    ImGui::SliderFloat("step", &_cloud_data.step, .1f, 3.f);
+    ImGui::SliderInt("max_steps", &_cloud_data.max_steps, 0, 128);
+    ImGui::SliderFloat("cutoff", &_cloud_data.cutoff, 0.f, 1.f);
+    ImGui::SliderFloat("density", &_cloud_data.density, 0.f, 3.f);
+    ImGui::ColorEdit3("sun_color", (float *)&_cloud_data.sun_color);
+    ImGui::ColorEdit3("sky_color", (float *)&_cloud_data.sky_color);
+    ImGui::SliderFloat3("sun_dir", (float *)&_cloud_data.sun_dir, -1.f, 1.f);
     ImGui::End();
 
     auto black = ImVec4(.1f, .1f, .1f, 1.f);
@@ -389,14 +1407,131 @@ void vk_engine::draw_comp(frame *frame)
     style.Colors[ImGuiCol_ButtonHovered] = black;
     style.Colors[ImGuiCol_ButtonActive] = black;
 
+    /* async passes go out first, the graphics submit waits on comp_sem */
+    if (_async_comp)
+        submit_comp(frame);
+
+    acquire(frame->cbuffer);
+    build_mips(frame->cbuffer);
+
     vk_cmd::vk_img_layout_transition(frame->cbuffer, _target.img,
                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                                      VK_IMAGE_LAYOUT_GENERAL, _comp_index);
 
-    for (cs &cs : css)
+    for (cs &cs : css) {
+        if (_async_comp && cs.async)
+            continue;
+
+        uint32_t query = _profiler.begin(frame->cbuffer, cs.name);
         cs.draw(frame->cbuffer, &cs);
+        _profiler.end(frame->cbuffer, query);
+
+        release_outputs(frame->cbuffer, &cs);
+        build_mips(frame->cbuffer);
+    }
+
+    /* persistent outputs go back to compute, acquired by the next submit_comp */
+    if (_async_comp) {
+        for (cs &cs : css) {
+            if (!cs.async || !cs.persistent)
+                continue;
+
+            for (std::string &name : cs.outputs) {
+                VkImage img = cs.allocator.get_img(name).img;
+                vk_cmd::vk_img_layout_transition(frame->cbuffer, img,
+                                                 VK_IMAGE_LAYOUT_GENERAL,
+                                                 VK_IMAGE_LAYOUT_GENERAL, _gfx_index,
+                                                 _comp_index);
+                _comp_acquires.push_back(img);
+            }
+        }
+    }
 
     vk_cmd::vk_img_layout_transition(frame->cbuffer, _target.img, VK_IMAGE_LAYOUT_GENERAL,
                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                                      _comp_index);
 }
+
+void vk_engine::draw_occlusion(frame *frame)
+{
+    /* sampled by pyramid.comp, then attached again for the late half */
+    vk_cmd::vk_depth_layout_transition(frame->cbuffer, _depth_img.img,
+                                       VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                                       VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                                       _gfx_index);
+
+    for (cs &cs : late_css) {
+        uint32_t query = _profiler.begin(frame->cbuffer, cs.name);
+        cs.draw(frame->cbuffer, &cs);
+        _profiler.end(frame->cbuffer, query);
+    }
+
+    vk_cmd::vk_depth_layout_transition(frame->cbuffer, _depth_img.img,
+                                       VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                                       VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                                       _gfx_index);
+}
+
+void vk_engine::submit_comp(frame *frame)
+{
+    /* the fence of this frame covers comp_cbuffer, cbuffer waited on it */
+    VkCommandBufferBeginInfo cbuffer_begin_info = vk_boiler::cbuffer_begin_info();
+
+    VK_CHECK(vkBeginCommandBuffer(frame->comp_cbuffer, &cbuffer_begin_info));
+
+    for (VkImage img : _comp_acquires)
+        vk_cmd::vk_img_layout_transition(frame->comp_cbuffer, img,
+                                         VK_IMAGE_LAYOUT_GENERAL,
+                                         VK_IMAGE_LAYOUT_GENERAL, _gfx_index,
+                                         _comp_index);
+
+    _comp_acquires.clear();
+
+    /* timed with the pools of the compute queue, reset on this cbuffer */
+    _profiler.begin_frame(frame->comp_cbuffer, _frame_index, _frame_number,
+                          gpu_profiler::COMPUTE);
+
+    for (cs &cs : css) {
+        if (!cs.async)
+            continue;
+
+        uint32_t query = _profiler.begin(frame->comp_cbuffer, cs.name,
+                                         gpu_profiler::COMPUTE);
+        cs.draw(frame->comp_cbuffer, &cs);
+        _profiler.end(frame->comp_cbuffer, query, gpu_profiler::COMPUTE);
+
+        release_outputs(frame->comp_cbuffer, &cs);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(frame->comp_cbuffer));
+
+    /*
+        outputs are written every frame, wait until the previous graphics
+        submit, the last one reading them, is done
+    */
+    VkPipelineStageFlags pipeline_stage_flags = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    VkSubmitInfo submit_info = vk_boiler::submit_info(
+        &frame->comp_cbuffer, &_comp_wait_sem, &frame->comp_sem, &pipeline_stage_flags);
+
+    if (_comp_wait_sem == VK_NULL_HANDLE)
+        submit_info.waitSemaphoreCount = 0;
+
+    VK_CHECK(vkQueueSubmit(_comp_queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    _comp_wait_sem = VK_NULL_HANDLE;
+    frame->comp_submitted = true;
+}
+
+void vk_engine::release_outputs(VkCommandBuffer cbuffer, cs *cs)
+{
+    for (std::string &name : cs->outputs) {
+        ownership_transfer transfer = {};
+        transfer.img = cs->allocator.get_img(name).img;
+        transfer.old_layout = VK_IMAGE_LAYOUT_GENERAL;
+        transfer.new_layout = VK_IMAGE_LAYOUT_GENERAL;
+        /* only async passes were recorded on _comp_queue */
+        transfer.src_index = _async_comp && cs->async ? _comp_index : _gfx_index;
+        release(cbuffer, transfer);
+    }
+}
@@ -0,0 +1,161 @@
+#include "vk_arena.h"
+
+#include <algorithm>
+#include <iterator>
+
+void offset_allocator::init(uint32_t size)
+{
+    ranges.clear();
+    ranges[0] = size;
+}
+
+uint32_t offset_allocator::allocate(uint32_t count)
+{
+    if (count == 0)
+        return 0;
+
+    for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+        if (range->second < count)
+            continue;
+
+        uint32_t offset = range->first;
+        uint32_t left = range->second - count;
+        ranges.erase(range);
+
+        if (left)
+            ranges[offset + count] = left;
+
+        return offset;
+    }
+
+    return NO_SPACE;
+}
+
+void offset_allocator::free(uint32_t offset, uint32_t count)
+{
+    if (count == 0)
+        return;
+
+    auto next = ranges.lower_bound(offset);
+
+    /* merge with the free range right after */
+    if (next != ranges.end() && offset + count == next->first) {
+        count += next->second;
+        next = ranges.erase(next);
+    }
+
+    /* and the one right before */
+    if (next != ranges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += count;
+            return;
+        }
+    }
+
+    ranges[offset] = count;
+}
+
+void mesh_arena::init(VmaAllocator allocator, uint32_t vertex_size, uint32_t index_size,
+                      uint32_t vertices, uint32_t indices,
+                      std::vector<uint32_t> families)
+{
+    this->allocator = allocator;
+    this->vertex_size = vertex_size;
+    this->index_size = index_size;
+    this->vertices = vertices;
+    this->indices = indices;
+
+    std::sort(families.begin(), families.end());
+    families.erase(std::unique(families.begin(), families.end()), families.end());
+    this->families = families;
+
+    create_block(vertices, indices);
+}
+
+void mesh_arena::destroy()
+{
+    for (block &block : blocks) {
+        vmaDestroyBuffer(allocator, block.vertices.buffer, block.vertices.allocation);
+        vmaDestroyBuffer(allocator, block.indices.buffer, block.indices.allocation);
+    }
+
+    blocks.clear();
+}
+
+arena_range mesh_arena::allocate(uint32_t vertex_count, uint32_t index_count)
+{
+    arena_range range = {};
+    range.vertex_count = vertex_count;
+    range.index_count = index_count;
+
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        uint32_t first_vertex = blocks[i].vertex_ranges.allocate(vertex_count);
+        if (first_vertex == offset_allocator::NO_SPACE)
+            continue;
+
+        uint32_t first_index = blocks[i].index_ranges.allocate(index_count);
+        if (first_index == offset_allocator::NO_SPACE) {
+            blocks[i].vertex_ranges.free(first_vertex, vertex_count);
+            continue;
+        }
+
+        range.block = i;
+        range.first_vertex = first_vertex;
+        range.first_index = first_index;
+        return range;
+    }
+
+    /* full everywhere, a mesh larger than a block gets a block of its own size */
+    create_block(std::max(vertices, vertex_count), std::max(indices, index_count));
+
+    range.block = blocks.size() - 1;
+    range.first_vertex = blocks.back().vertex_ranges.allocate(vertex_count);
+    range.first_index = blocks.back().index_ranges.allocate(index_count);
+    return range;
+}
+
+void mesh_arena::free(const arena_range &range)
+{
+    if (range.block == NO_BLOCK)
+        return;
+
+    blocks[range.block].vertex_ranges.free(range.first_vertex, range.vertex_count);
+    blocks[range.block].index_ranges.free(range.first_index, range.index_count);
+}
+
+void mesh_arena::create_block(uint32_t vertices, uint32_t indices)
+{
+    block block = {};
+    block.vertices = create_buffer((VkDeviceSize)vertices * vertex_size,
+                                   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    block.indices = create_buffer((VkDeviceSize)indices * index_size,
+                                  VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    block.vertex_ranges.init(vertices);
+    block.index_ranges.init(indices);
+
+    blocks.push_back(block);
+}
+
+allocated_buffer mesh_arena::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    VkBufferCreateInfo buffer_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    buffer_info.size = size;
+    buffer_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    if (families.size() > 1) {
+        buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buffer_info.queueFamilyIndexCount = families.size();
+        buffer_info.pQueueFamilyIndices = families.data();
+    }
+
+    VmaAllocationCreateInfo vma_allocation_info = {};
+    vma_allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+
+    allocated_buffer buffer = {};
+    VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &vma_allocation_info,
+                             &buffer.buffer, &buffer.allocation, nullptr));
+    buffer.size = size;
+
+    return buffer;
+}
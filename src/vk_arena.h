@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <volk.h>
+
+#include "vk_mem_alloc.h"
+
+#include "vk_type.h"
+
+constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+/* first fit over the free ranges of [0, size), neighbours merge on free */
+struct offset_allocator {
+public:
+    static constexpr uint32_t NO_SPACE = UINT32_MAX;
+
+    void init(uint32_t size);
+
+    /* offset of count free elements, NO_SPACE when no range is large enough */
+    uint32_t allocate(uint32_t count);
+
+    void free(uint32_t offset, uint32_t count);
+
+private:
+    /* offset to length of every free range */
+    std::map<uint32_t, uint32_t> ranges;
+};
+
+/* where a mesh lives in the arena, in vertices and indices */
+struct arena_range {
+    uint32_t block = NO_BLOCK;
+    uint32_t first_vertex = 0;
+    uint32_t vertex_count = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+};
+
+/*
+    Vertices and indices of every mesh in a few large device local buffers,
+    one vertex and one index buffer per block. Meshes take ranges out of the
+    blocks and give them back when unloaded, a new block is only added when
+    no existing one has room.
+
+        arena.init(allocator, sizeof(vertex), sizeof(uint16_t), 1 << 20, 1 << 22,
+                   families);
+        arena_range range = arena.allocate(vertices.size(), indices.size());
+        ... copy into arena.vertex_buffer(range.block) at range.first_vertex ...
+        vkCmdDrawIndexed(cbuffer, range.index_count, 1, range.first_index,
+                         range.first_vertex, 0);
+        ...
+        arena.free(range);      // once no frame in flight draws it
+
+    indices stay relative to their mesh, the draw's vertexOffset places them.
+    With more than one family the buffers are shared concurrently, uploads on
+    the transfer queue need no ownership transfer.
+*/
+
+struct mesh_arena {
+public:
+    void init(VmaAllocator allocator, uint32_t vertex_size, uint32_t index_size,
+              uint32_t vertices, uint32_t indices, std::vector<uint32_t> families);
+
+    void destroy();
+
+    arena_range allocate(uint32_t vertex_count, uint32_t index_count);
+
+    void free(const arena_range &range);
+
+    inline VkBuffer vertex_buffer(uint32_t i) { return blocks[i].vertices.buffer; };
+    inline VkBuffer index_buffer(uint32_t i) { return blocks[i].indices.buffer; };
+
+    inline uint32_t block_count() { return blocks.size(); };
+
+private:
+    struct block {
+        allocated_buffer vertices;
+        allocated_buffer indices;
+        offset_allocator vertex_ranges;
+        offset_allocator index_ranges;
+    };
+
+    VmaAllocator allocator = VK_NULL_HANDLE;
+    uint32_t vertex_size = 0;
+    uint32_t index_size = 0;
+    uint32_t vertices = 0;
+    uint32_t indices = 0;
+    std::vector<uint32_t> families;
+
+    std::vector<block> blocks;
+
+    void create_block(uint32_t vertices, uint32_t indices);
+    allocated_buffer create_buffer(VkDeviceSize size, VkBufferUsageFlags usage);
+};
@@ -0,0 +1,401 @@
+#include "vk_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/packing.hpp>
+
+#include "vk_cloud.h"
+#include "vk_noise.h"
+#include "vk_pool.h"
+#include "vk_raymarch.h"
+
+/*
+    vk_engine_bench renders a fixed camera pose headless and sweeps the
+    cloud raymarcher over a grid of parameters, one csv row per point.
+
+        vk_engine_bench --frames 64 --warmup 8 --output bench.csv
+
+    _resolution, cloudtex_size and weather_size are baked in at init, the
+    engine is not built to be initialized twice in one process, so each of
+    those combinations runs in a child process (--run <index>) appending to
+    the same table. cloud_data is uploaded every frame and is swept in-process.
+
+        vk_engine_bench --verify-noise
+
+    instead generates "cloudtex" and "weather" on the gpu, reads them back and
+    compares them with vk_noise, returning 1 when they drift apart. it runs on
+    a software icd (lavapipe, swiftshader) as well as on hardware.
+
+        vk_engine_bench --cpu frame.ppm
+
+    renders the default view with vk_noise and vk_raymarch alone, no vulkan
+    device needed, and reports how long each stage took.
+*/
+
+struct bench_init {
+    VkExtent2D resolution;
+    uint32_t cloudtex_size;
+    uint32_t weather_size;
+};
+
+static const VkExtent2D resolutions[] = { {512, 384}, {1024, 768} };
+static const uint32_t cloudtex_sizes[] = { 64, 128 };
+static const uint32_t weather_sizes[] = { 256, 512 };
+
+static const int max_steps[] = { 32, 64, 96, 128 };
+static const float steps[] = { .2f, .4f, .8f };
+static const float densities[] = { .5f, 1.f };
+static const float cutoffs[] = { .1f, .3f, .5f };
+
+static std::vector<bench_init> init_grid()
+{
+    std::vector<bench_init> grid;
+
+    for (VkExtent2D resolution : resolutions)
+        for (uint32_t cloudtex_size : cloudtex_sizes)
+            for (uint32_t weather_size : weather_sizes)
+                grid.push_back(bench_init{resolution, cloudtex_size, weather_size});
+
+    return grid;
+}
+
+static float get_mean(gpu_profiler &profiler, std::string name)
+{
+    for (const pass_stat &stat : profiler.get_stats())
+        if (stat.name == name)
+            return stat.mean_ms;
+
+    /* a pass without timestamps reads 0, say so */
+    std::cerr << "bench: " << name << " was not timed" << std::endl;
+    return 0.f;
+}
+
+struct noise_error {
+    float max;
+    float mean;
+    float within;
+};
+
+/* one channel of half floats against the cpu volume, within is |error| <= tolerance */
+static noise_error compare(const std::vector<char> &gpu, const std::vector<float> &cpu,
+                           uint32_t channels, uint32_t channel, float tolerance)
+{
+    const uint16_t *halfs = (const uint16_t *)gpu.data();
+    size_t count = cpu.size() / channels;
+    noise_error error = {};
+    double sum = 0.0;
+    size_t within = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = i * channels + channel;
+        float e = std::abs(glm::unpackHalf1x16(halfs[index]) - cpu[index]);
+        error.max = std::max(error.max, e);
+        sum += e;
+        within += e <= tolerance;
+    }
+
+    error.mean = (float)(sum / count);
+    error.within = (float)within / count;
+
+    return error;
+}
+
+static int verify_noise()
+{
+    /* one queue so both images stay readable, nothing from the cache */
+    vk_engine engine = {};
+    engine._headless = true;
+    engine._single_queue = true;
+    engine._noise_cache = nullptr;
+    engine._resolution = VkExtent2D{256, 192};
+    engine._window_extent = engine._resolution;
+    engine._cloudtex_size = 64;
+    engine._weather_size = 256;
+    engine.init();
+
+    std::vector<char> cloudtex, weather;
+    bool read = engine.read_img("cloudtex", 8, cloudtex) &&
+                engine.read_img("weather", 2, weather);
+
+    uint32_t cloudtex_size = engine._cloudtex_size;
+    uint32_t weather_size = (uint32_t)std::lround(std::sqrt(weather.size() / 2.0));
+    engine.cleanup();
+
+    if (!read) {
+        std::cerr << "verify: failed to read back the noise images" << std::endl;
+        return 1;
+    }
+
+    thread_pool pool;
+    std::vector<float> cpu_cloudtex, cpu_weather;
+
+    auto begin = std::chrono::steady_clock::now();
+    vk_noise::cloudtex(pool, cloudtex_size, cpu_cloudtex);
+    auto end = std::chrono::steady_clock::now();
+    vk_noise::weather(pool, weather_size, weather_period, 0.f,
+                      (float)weather_size, cpu_weather);
+
+    std::cout << "verify: " << vk_noise::lanes << " lanes, " << pool.size()
+              << " threads, cloudtex " << cloudtex_size << "^3 in "
+              << std::chrono::duration<float, std::milli>(end - begin).count() << " ms"
+              << std::endl;
+
+    /*
+        the weather map follows the shader texel for texel, up to half
+        precision. every cloudtex channel goes through the worley hash,
+        fract(sin(x) * 43758.5453) turns a dot product fused into an fma by
+        the driver into another feature point, so those get a tolerance
+    */
+    bool passed = true;
+
+    for (uint32_t channel = 0; channel < 4; ++channel) {
+        noise_error error = compare(cloudtex, cpu_cloudtex, 4, channel, .1f);
+        passed &= error.within >= .95f && error.mean <= .05f;
+
+        std::cout << "verify: cloudtex." << "rgba"[channel] << " max " << error.max
+                  << " mean " << error.mean << " within .1 " << error.within * 100.f
+                  << "%" << std::endl;
+    }
+
+    noise_error error = compare(weather, cpu_weather, 1, 0, .01f);
+    passed &= error.within >= .99f;
+
+    std::cout << "verify: weather max " << error.max << " mean " << error.mean
+              << " within .01 " << error.within * 100.f << "%" << std::endl;
+
+    std::cout << "verify: " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
+
+static float ms_since(std::chrono::steady_clock::time_point begin)
+{
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<float, std::milli>(end - begin).count();
+}
+
+static int cpu_preview(const char *output)
+{
+    /* defaults only, the engine is never initialized */
+    vk_engine engine = {};
+    VkExtent2D resolution = engine._resolution;
+
+    camera_data camera;
+    camera.pos = engine._vk_camera.get_pos();
+    camera.dir = engine._vk_camera.get_dir();
+    camera.up = engine._vk_camera.get_up();
+    camera.fov = engine._vk_camera.get_fov();
+
+    /* the cached weather map, unscrolled */
+    cloud_data cloud = engine._cloud_data;
+    cloud.weather_wrap = 1;
+
+    thread_pool pool;
+    vk_raymarch::volumes volumes;
+    std::vector<uint16_t> rgba;
+
+    auto begin = std::chrono::steady_clock::now();
+    volumes.cloudtex_size = engine._cloudtex_size;
+    vk_noise::cloudtex(pool, volumes.cloudtex_size, volumes.cloudtex);
+    float cloudtex_ms = ms_since(begin);
+
+    /* the cached map the engine generates once, at time 0 */
+    begin = std::chrono::steady_clock::now();
+    volumes.weather_size = weather_cache_scale * engine._weather_size;
+    vk_noise::weather(pool, volumes.weather_size, weather_period, 0.f,
+                      (float)volumes.weather_size, volumes.weather);
+    float weather_ms = ms_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    vk_raymarch::light(pool, cloud, volumes);
+    float light_ms = ms_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    vk_raymarch::trace(pool, volumes, cloud, camera, resolution.width, resolution.height,
+                       rgba);
+    float cloud_ms = ms_since(begin);
+
+    std::cout << "cpu: " << vk_noise::lanes << " lanes, " << pool.size()
+              << " threads, cloudtex " << cloudtex_ms << " ms, weather " << weather_ms
+              << " ms, light " << light_ms << " ms, cloud " << cloud_ms << " ms"
+              << std::endl;
+
+    std::ofstream f(output, std::ios::binary);
+
+    if (!f.is_open()) {
+        std::cerr << "cpu: failed to open " << output << std::endl;
+        return 1;
+    }
+
+    f << "P6\n" << resolution.width << " " << resolution.height << "\n255\n";
+
+    for (size_t i = 0; i < rgba.size(); i += 4)
+        for (size_t c = 0; c < 3; ++c) {
+            float v = std::min(std::max(glm::unpackHalf1x16(rgba[i + c]), 0.f), 1.f);
+            f.put((char)(v * 255.f));
+        }
+
+    return 0;
+}
+
+static int run(bench_init config, uint64_t frames, uint64_t warmup, const char *output)
+{
+    std::ofstream f(output, std::ios::app);
+
+    if (!f.is_open()) {
+        std::cerr << "bench: failed to open " << output << std::endl;
+        return 1;
+    }
+
+    vk_engine engine = {};
+    engine._headless = true;
+    engine._cache_stats = true;
+    engine._fixed_dt = 1.f / 60.f;
+    engine._resolution = config.resolution;
+    engine._window_extent = config.resolution;
+    engine._cloudtex_size = config.cloudtex_size;
+    engine._weather_size = config.weather_size;
+    engine.init();
+
+    /* settle the cloud workgroup shape before anything is timed */
+    while (engine._cloud_tuner.tuning) {
+        engine._max_frames = vk_tune::SAMPLES;
+        engine.run();
+    }
+
+    for (int max_step : max_steps)
+        for (float step : steps)
+            for (float density : densities)
+                for (float cutoff : cutoffs) {
+                    engine._cloud_data.max_steps = max_step;
+                    engine._cloud_data.step = step;
+                    engine._cloud_data.density = density;
+                    engine._cloud_data.cutoff = cutoff;
+
+                    if (warmup) {
+                        engine._max_frames = warmup;
+                        engine.run();
+                    }
+
+                    vkDeviceWaitIdle(engine._device);
+                    engine._profiler.flush();
+                    engine._profiler.reset_stats();
+
+                    /* cpu time covers recording, submission and the fence waits */
+                    engine._max_frames = frames;
+                    auto begin = std::chrono::steady_clock::now();
+                    engine.run();
+                    vkDeviceWaitIdle(engine._device);
+                    auto end = std::chrono::steady_clock::now();
+
+                    engine._profiler.flush();
+
+                    float cpu_ms =
+                        std::chrono::duration<float, std::milli>(end - begin).count() /
+                        frames;
+
+                    f << config.resolution.width << "," << config.resolution.height
+                      << "," << config.cloudtex_size << "," << config.weather_size << ","
+                      << max_step << "," << step << "," << density << "," << cutoff
+                      << "," << frames << "," << cpu_ms << ","
+                      << get_mean(engine._profiler, "frame") << ","
+                      << get_mean(engine._profiler, "weather") << ","
+                      << get_mean(engine._profiler, "light") << ","
+                      << get_mean(engine._profiler, "cloud") << std::endl;
+                }
+
+    engine.cleanup();
+    return 0;
+}
+
+/* a whole number in [min, max] or a message, as in main.cpp */
+static bool parse_count(const char *flag, const char *arg, uint32_t min, uint32_t max,
+                        uint32_t *value)
+{
+    char *end;
+    unsigned long n = std::strtoul(arg, &end, 10);
+
+    if (end == arg || *end || n < min || n > max) {
+        std::cerr << flag << ": expected a number from " << min << " to " << max
+                  << ", got " << arg << std::endl;
+        return false;
+    }
+
+    *value = (uint32_t)n;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t frames = 64;
+    uint32_t warmup = 8;
+    const char *output = "bench.csv";
+    int index = -1;
+
+    std::vector<bench_init> grid = init_grid();
+
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--frames") && i + 1 < argc) {
+            if (!parse_count(argv[i], argv[i + 1], 1, 1 << 20, &frames))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            if (!parse_count(argv[i], argv[i + 1], 0, 1 << 20, &warmup))
+                return 1;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+            output = argv[++i];
+        else if (!std::strcmp(argv[i], "--run") && i + 1 < argc) {
+            uint32_t run_index;
+            if (!parse_count(argv[i], argv[i + 1], 0, grid.size() - 1, &run_index))
+                return 1;
+            index = run_index;
+            ++i;
+        } else if (!std::strcmp(argv[i], "--verify-noise"))
+            return verify_noise();
+        else if (!std::strcmp(argv[i], "--cpu") && i + 1 < argc)
+            return cpu_preview(argv[++i]);
+    }
+
+    if (index >= 0)
+        return run(grid[index], frames, warmup, output);
+
+    {
+        std::ofstream f(output, std::ios::trunc);
+
+        if (!f.is_open()) {
+            std::cerr << "bench: failed to open " << output << std::endl;
+            return 1;
+        }
+
+        f << "width,height,cloudtex_size,weather_size,max_steps,step,density,cutoff,"
+             "frames,cpu_ms,gpu_ms,weather_ms,light_ms,cloud_ms"
+          << std::endl;
+    }
+
+    int failed = 0;
+
+    for (uint32_t i = 0; i < grid.size(); ++i) {
+        std::string cmd = std::string("\"") + argv[0] + "\" --run " + std::to_string(i) +
+                          " --frames " + std::to_string(frames) + " --warmup " +
+                          std::to_string(warmup) + " --output \"" + output + "\"";
+
+        std::cout << "bench: " << grid[i].resolution.width << "x"
+                  << grid[i].resolution.height << " cloudtex " << grid[i].cloudtex_size
+                  << " weather " << grid[i].weather_size << std::endl;
+
+        if (std::system(cmd.c_str()) != 0) {
+            std::cerr << "bench: configuration " << i << " failed" << std::endl;
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#include "vk_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;
+};
+
+static const char cache_magic[4] = { 'V', 'K', 'C', 'H' };
+static const uint32_t cache_version = 1;
+
+uint64_t vk_cache::fnv1a(const void *data, size_t size, uint64_t hash)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+bool vk_cache::read(const std::string &path, uint64_t key, std::vector<char> &data)
+{
+    std::ifstream f(path, std::ios::binary);
+
+    if (!f.is_open())
+        return false;
+
+    cache_header header = {};
+    f.read((char *)&header, sizeof(cache_header));
+
+    /* anything unexpected is a miss, the caller regenerates and overwrites it */
+    if (!f || std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) ||
+        header.version != cache_version || header.key != key)
+        return false;
+
+    data.resize(header.size);
+    f.read(data.data(), header.size);
+
+    if (!f) {
+        std::cerr << "cache: " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool vk_cache::write(const std::string &path, uint64_t key, const void *data, size_t size)
+{
+    /* write aside and rename, a crash never leaves a torn file under path */
+    std::string tmp = path + ".tmp";
+    std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+
+    if (!f.is_open()) {
+        std::cerr << "cache: failed to open " << tmp << std::endl;
+        return false;
+    }
+
+    cache_header header = {};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.key = key;
+    header.size = size;
+
+    f.write((const char *)&header, sizeof(cache_header));
+    f.write((const char *)data, size);
+    f.close();
+
+    if (!f) {
+        std::cerr << "cache: failed to write " << tmp << std::endl;
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    std::remove(path.c_str());
+    if (std::rename(tmp.c_str(), path.c_str())) {
+        std::cerr << "cache: failed to rename " << tmp << std::endl;
+        return false;
+    }
+
+    return true;
+}
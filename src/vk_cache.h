@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    Blobs on disk behind a small header, stale when the key does not match.
+
+        uint64_t key = vk_cache::fnv1a(spv, sizeof(spv));
+        key = vk_cache::fnv1a(&size, sizeof(size), key);
+
+        if (!vk_cache::read(path, key, data)) {
+            ... generate data ...
+            vk_cache::write(path, key, data);
+        }
+*/
+
+namespace vk_cache
+{
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = FNV_OFFSET);
+
+bool read(const std::string &path, uint64_t key, std::vector<char> &data);
+
+bool write(const std::string &path, uint64_t key, const void *data, size_t size);
+} // namespace vk_cache
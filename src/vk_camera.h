@@ -38,6 +38,25 @@ public:
         return glm::perspective(glm::radians(fov), aspect, .01f, 100.f);
     }
 
+    /* planes of proj * view facing inward, xyz normalized so w is a distance */
+    inline void get_frustum(glm::vec4 planes[6])
+    {
+        glm::mat4 m = get_proj_mat() * get_view_mat();
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i)
+            rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+        planes[0] = rows[3] + rows[0];
+        planes[1] = rows[3] - rows[0];
+        planes[2] = rows[3] + rows[1];
+        planes[3] = rows[3] - rows[1];
+        planes[4] = rows[3] + rows[2];
+        planes[5] = rows[3] - rows[2];
+
+        for (int i = 0; i < 6; ++i)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
     inline glm::vec3 get_pos() { return pos; };
     inline glm::vec3 get_dir() { return dir; };
     inline glm::vec3 get_up() { return up; };
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+/* cached weather map, repeating every weather_period noise cells */
+constexpr uint32_t weather_cache_scale = 2;
+constexpr int weather_period = 8;
+
+/* uniform blocks of cloud.comp, laid out to match std140 */
+
+struct camera_data {
+    alignas(16) glm::vec3 pos;
+    alignas(16) glm::vec3 dir;
+    alignas(16) glm::vec3 up;
+    alignas(4) float fov;
+};
+
+struct cloud_data {
+    alignas(4) float type = .6f;
+    alignas(4) float freq = .2f;
+    alignas(4) float ambient = 1.f;
+    alignas(4) float sigma_a = 0.f;
+    alignas(4) float sigma_s = .6f;
+    alignas(4) float step = .4f;
+    alignas(4) int max_steps = 96;
+    alignas(4) float cutoff = .3f;
+    alignas(4) float density = 1.f;
+    alignas(16) glm::vec3 sun_color = glm::vec3(.99f, .36f, .32f);
+    alignas(16) glm::vec3 sky_color = glm::vec3(.98f, .83f, .64f);
+    alignas(8) glm::vec2 weather_offset = glm::vec2(0.f);
+    alignas(4) int weather_wrap = 0;
+    alignas(16) glm::vec3 sun_dir = glm::vec3(0.f, .6f, 1.f);
+};
+
+/* push constants of weather.comp, period 0 regenerates the whole map */
+struct weather_data {
+    alignas(8) glm::ivec2 offset;
+    alignas(4) float time;
+    alignas(4) int period;
+};
+
+/*
+    push constants of cloud.comp, trace the pixel at jitter of every stride block
+    of a 1 / scale resolution grid
+*/
+struct trace_data {
+    alignas(8) glm::ivec2 jitter;
+    alignas(4) int stride;
+    alignas(4) int raw;
+    alignas(4) int scale;
+};
+
+/* push constants of temporal.comp */
+struct temporal_data {
+    alignas(8) glm::ivec2 jitter;
+    alignas(4) int stride;
+    alignas(4) int parity;
+    alignas(4) int reset;
+    alignas(4) int scale;
+};
+
+/* push constants of light.comp, first slice to write */
+struct light_data {
+    alignas(4) int offset;
+};
+
+/* push constants of upsample.comp, parity picks the temporal history to read */
+struct upsample_data {
+    alignas(4) int scale;
+    alignas(4) int parity;
+};
@@ -1,30 +1,120 @@
 #include "vk_cmd.h"
 
+#include <algorithm>
+
 #include "vk_boiler.h"
 
 void vk_cmd::vk_img_layout_transition(VkCommandBuffer cbuffer, VkImage img,
                                       VkImageLayout old_layout, VkImageLayout new_layout,
                                       uint32_t family_index)
 {
-    VkImageSubresourceRange subresource_range =
-        vk_boiler::img_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+    vk_img_layout_transition(cbuffer, img, old_layout, new_layout, family_index,
+                             family_index);
+}
+
+static void img_barrier(VkCommandBuffer cbuffer, VkImage img, VkImageAspectFlags aspect,
+                        VkImageLayout old_layout, VkImageLayout new_layout,
+                        uint32_t src_family_index, uint32_t dst_family_index)
+{
+    VkImageSubresourceRange subresource_range = vk_boiler::img_subresource_range(aspect);
+    subresource_range.levelCount = VK_REMAINING_MIP_LEVELS;
     VkImageMemoryBarrier img_mem_barrier = vk_boiler::img_mem_barrier();
     img_mem_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     img_mem_barrier.pNext = nullptr;
-    // img_mem_barrier.srcAccessMask = ;
-    // img_mem_barrier.dstAccessMask = ;
+    img_mem_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    img_mem_barrier.dstAccessMask =
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
     img_mem_barrier.oldLayout = old_layout;
     img_mem_barrier.newLayout = new_layout;
-    img_mem_barrier.srcQueueFamilyIndex = family_index;
-    img_mem_barrier.dstQueueFamilyIndex = family_index;
+    img_mem_barrier.srcQueueFamilyIndex = src_family_index;
+    img_mem_barrier.dstQueueFamilyIndex = dst_family_index;
     img_mem_barrier.image = img;
     img_mem_barrier.subresourceRange = subresource_range;
 
-    vkCmdPipelineBarrier(cbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1,
+    /* all commands, the same barrier is valid on graphics, compute and transfer queues */
+    vkCmdPipelineBarrier(cbuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1,
                          &img_mem_barrier);
 }
 
+void vk_cmd::vk_img_layout_transition(VkCommandBuffer cbuffer, VkImage img,
+                                      VkImageLayout old_layout, VkImageLayout new_layout,
+                                      uint32_t src_family_index,
+                                      uint32_t dst_family_index)
+{
+    img_barrier(cbuffer, img, VK_IMAGE_ASPECT_COLOR_BIT, old_layout, new_layout,
+                src_family_index, dst_family_index);
+}
+
+void vk_cmd::vk_depth_layout_transition(VkCommandBuffer cbuffer, VkImage img,
+                                        VkImageLayout old_layout,
+                                        VkImageLayout new_layout, uint32_t family_index)
+{
+    img_barrier(cbuffer, img, VK_IMAGE_ASPECT_DEPTH_BIT, old_layout, new_layout,
+                family_index, family_index);
+}
+
+void vk_cmd::vk_buffer_ownership_transfer(VkCommandBuffer cbuffer, VkBuffer buffer,
+                                          uint32_t src_family_index,
+                                          uint32_t dst_family_index)
+{
+    VkBufferMemoryBarrier buffer_mem_barrier = {};
+    buffer_mem_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_mem_barrier.pNext = nullptr;
+    buffer_mem_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    buffer_mem_barrier.dstAccessMask =
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    buffer_mem_barrier.srcQueueFamilyIndex = src_family_index;
+    buffer_mem_barrier.dstQueueFamilyIndex = dst_family_index;
+    buffer_mem_barrier.buffer = buffer;
+    buffer_mem_barrier.offset = 0;
+    buffer_mem_barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(cbuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1,
+                         &buffer_mem_barrier, 0, nullptr);
+}
+
+void vk_cmd::vk_buffer_barrier(VkCommandBuffer cbuffer, VkBuffer buffer)
+{
+    vk_buffer_ownership_transfer(cbuffer, buffer, VK_QUEUE_FAMILY_IGNORED,
+                                 VK_QUEUE_FAMILY_IGNORED);
+}
+
+void vk_cmd::vk_img_mips(VkCommandBuffer cbuffer, VkImage img, VkExtent3D extent,
+                         uint32_t mip_levels)
+{
+    VkOffset3D size = {(int32_t)extent.width, (int32_t)extent.height,
+                       (int32_t)extent.depth};
+
+    for (uint32_t i = 1; i < mip_levels; ++i) {
+        VkOffset3D next = {std::max(size.x / 2, 1), std::max(size.y / 2, 1),
+                           std::max(size.z / 2, 1)};
+
+        VkImageBlit blit = {};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = i - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.srcOffsets[1] = size;
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = i;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+        blit.dstOffsets[1] = next;
+
+        /* general on both ends, so the image never leaves the layout it is used in */
+        vkCmdBlitImage(cbuffer, img, VK_IMAGE_LAYOUT_GENERAL, img,
+                       VK_IMAGE_LAYOUT_GENERAL, 1, &blit, VK_FILTER_LINEAR);
+
+        /* level i is the source of the next blit */
+        vk_img_layout_transition(cbuffer, img, VK_IMAGE_LAYOUT_GENERAL,
+                                 VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_FAMILY_IGNORED);
+
+        size = next;
+    }
+}
+
 void vk_cmd::vk_img_copy(VkCommandBuffer cbuffer, VkExtent3D extent, VkImage src,
                          VkImage dst)
 {
@@ -43,4 +133,29 @@ void vk_cmd::vk_img_copy(VkCommandBuffer cbuffer, VkExtent3D extent, VkImage src
 
     vkCmdCopyImage(cbuffer, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst,
                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &img_copy);
+}
+
+void vk_cmd::vk_img_buffer_copy(VkCommandBuffer cbuffer, VkExtent3D extent, VkImage src,
+                                VkBuffer dst)
+{
+    VkBufferImageCopy region = vk_boiler::buffer_img_copy(extent);
+
+    vkCmdCopyImageToBuffer(cbuffer, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst, 1,
+                           &region);
+
+    /* make the copy visible to host reads once the frame fence signals */
+    VkBufferMemoryBarrier buffer_mem_barrier = {};
+    buffer_mem_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_mem_barrier.pNext = nullptr;
+    buffer_mem_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_mem_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    buffer_mem_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_mem_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_mem_barrier.buffer = dst;
+    buffer_mem_barrier.offset = 0;
+    buffer_mem_barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(cbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &buffer_mem_barrier, 0, nullptr);
 }
\ No newline at end of file
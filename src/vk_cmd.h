@@ -8,5 +8,31 @@ void vk_img_layout_transition(VkCommandBuffer cbuffer, VkImage img,
                               VkImageLayout old_layout, VkImageLayout new_layout,
                               uint32_t family_index);
 
+/*
+    queue family ownership transfer, record it once on the releasing queue and
+    once more, with the same layouts and indices, on the acquiring queue
+*/
+void vk_img_layout_transition(VkCommandBuffer cbuffer, VkImage img,
+                              VkImageLayout old_layout, VkImageLayout new_layout,
+                              uint32_t src_family_index, uint32_t dst_family_index);
+
+/* the depth aspect, same family on both ends */
+void vk_depth_layout_transition(VkCommandBuffer cbuffer, VkImage img,
+                                VkImageLayout old_layout, VkImageLayout new_layout,
+                                uint32_t family_index);
+
+void vk_buffer_ownership_transfer(VkCommandBuffer cbuffer, VkBuffer buffer,
+                                  uint32_t src_family_index, uint32_t dst_family_index);
+
+/* makes earlier writes to buffer visible to later commands on the same queue */
+void vk_buffer_barrier(VkCommandBuffer cbuffer, VkBuffer buffer);
+
+/* blit every level from the one above, needs a graphics queue */
+void vk_img_mips(VkCommandBuffer cbuffer, VkImage img, VkExtent3D extent,
+                 uint32_t mip_levels);
+
 void vk_img_copy(VkCommandBuffer cbuffer, VkExtent3D extent, VkImage src, VkImage dst);
+
+void vk_img_buffer_copy(VkCommandBuffer cbuffer, VkExtent3D extent, VkImage src,
+                        VkBuffer dst);
 } // namespace vk_cmd
\ No newline at end of file
@@ -5,33 +5,26 @@
 
 #include "vk_boiler.h"
 
-void comp_allocator::create_new_pool()
+VkDescriptorSetLayout
+comp_allocator::get_layout(const std::vector<VkDescriptorType> &types)
 {
-    VkDescriptorPool new_pool;
+    auto cached = layouts.find(types);
+    if (cached != layouts.end())
+        return cached->second;
 
-    std::vector<VkDescriptorPoolSize> pool_sizes = {
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 256},
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 256},
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 256},
-    };
-
-    VkDescriptorPoolCreateInfo pool_info =
-        vk_boiler::descriptor_pool_create_info(pool_sizes.size(), pool_sizes.data());
-
-    vkCreateDescriptorPool(device, &pool_info, nullptr, &new_pool);
-
-    deletion_queue.push_back(
-        [=]() { vkDestroyDescriptorPool(device, new_pool, nullptr); });
+    VkDescriptorSetLayoutCreateInfo layout_info =
+        vk_boiler::descriptor_set_layout_create_info(types, VK_SHADER_STAGE_COMPUTE_BIT);
 
-    pools.push_back(new_pool);
-}
+    VkDescriptorSetLayout layout;
+    VK_CHECK(vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &layout));
 
-VkDescriptorPool comp_allocator::get_pool()
-{
-    if (!pools.size())
-        create_new_pool();
+    /* outlives this allocator, which is usually a local */
+    deletion_queue.push_back([device = device, layout]() {
+        vkDestroyDescriptorSetLayout(device, layout, nullptr);
+    });
 
-    return pools.back();
+    layouts[types] = layout;
+    return layout;
 }
 
 void comp_allocator::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
@@ -57,9 +50,11 @@ void comp_allocator::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
 
 void comp_allocator::create_img(VkFormat format, VkExtent3D extent,
                                 VkImageAspectFlags aspect, VkImageUsageFlags usage,
-                                VmaAllocationCreateFlags flags, std::string name)
+                                VmaAllocationCreateFlags flags, std::string name,
+                                uint32_t mip_levels)
 {
     VkImageCreateInfo img_info = vk_boiler::img_create_info(format, extent, usage);
+    img_info.mipLevels = mip_levels;
 
     VmaAllocationCreateInfo vma_allocation_info = {};
     vma_allocation_info.flags = flags;
@@ -75,30 +70,89 @@ void comp_allocator::create_img(VkFormat format, VkExtent3D extent,
 
     VkImageViewCreateInfo img_view_info =
         vk_boiler::img_view_create_info(aspect, imgs[name].img, extent, format);
+    img_view_info.subresourceRange.levelCount = mip_levels;
 
     VK_CHECK(vkCreateImageView(device, &img_view_info, nullptr, &imgs[name].img_view));
 
     deletion_queue.push_back(
         [=]() { vkDestroyImageView(device, imgs[name].img_view, nullptr); });
+
+    imgs[name].extent = extent;
+    imgs[name].mip_views.clear();
+
+    if (mip_levels == 1)
+        return;
+
+    /* storage image descriptors take a single level */
+    for (uint32_t i = 0; i < mip_levels; ++i) {
+        img_view_info.subresourceRange.baseMipLevel = i;
+        img_view_info.subresourceRange.levelCount = 1;
+
+        VkImageView mip_view;
+        VK_CHECK(vkCreateImageView(device, &img_view_info, nullptr, &mip_view));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroyImageView(device, mip_view, nullptr); });
+
+        imgs[name].mip_views.push_back(mip_view);
+    }
+}
+
+void comp_allocator::create_sampler(std::string name, uint32_t mip_levels,
+                                    VkImageLayout layout)
+{
+    VkSamplerCreateInfo sampler_info = vk_boiler::sampler_create_info();
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.minLod = 0.f;
+    sampler_info.maxLod = (float)mip_levels;
+
+    VkSampler sampler;
+    VK_CHECK(vkCreateSampler(device, &sampler_info, nullptr, &sampler));
+
+    deletion_queue.push_back([=]() { vkDestroySampler(device, sampler, nullptr); });
+
+    samplers[name] = sampled_img{sampler, layout};
 }
 
 void comp_allocator::allocate_descriptor_set(std::vector<VkDescriptorType> types,
                                              VkDescriptorSetLayout *layout,
                                              VkDescriptorSet *set)
 {
-    VkDescriptorSetLayoutCreateInfo layout_info =
-        vk_boiler::descriptor_set_layout_create_info(types, VK_SHADER_STAGE_COMPUTE_BIT);
+    if (!descriptors.device) {
+        descriptors.init(device, 64, true);
+        deletion_queue.push_back([]() { descriptors.destroy(); });
+    }
 
-    VK_CHECK(vkCreateDescriptorSetLayout(device, &layout_info, nullptr, layout));
+    *layout = get_layout(types);
+    *set = descriptors.allocate(*layout);
+};
 
-    deletion_queue.push_back(
-        [=]() { vkDestroyDescriptorSetLayout(device, *layout, nullptr); });
+void comp_allocator::free_descriptor_set(VkDescriptorSet set) { descriptors.free(set); }
 
-    VkDescriptorSetAllocateInfo descriptor_set_allocate_info =
-        vk_boiler::descriptor_set_allocate_info(get_pool(), layout);
+VkDescriptorSet comp_allocator::allocate_transient_set(VkDescriptorSetLayout layout,
+                                                       uint32_t frame)
+{
+    if (transient.size() <= frame)
+        transient.resize(frame + 1);
 
-    VK_CHECK(vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, set));
-};
+    if (!transient[frame].device) {
+        transient[frame].init(device, 16);
+        deletion_queue.push_back([=]() { transient[frame].destroy(); });
+    }
+
+    return transient[frame].allocate(layout);
+}
+
+void comp_allocator::reset_transient(uint32_t frame)
+{
+    if (frame < transient.size() && transient[frame].device)
+        transient[frame].reset();
+}
 
 void cs::write_descriptor_set(std::vector<VkDescriptorType> types,
                               std::vector<std::string> names)
@@ -123,9 +177,25 @@ void cs::write_descriptor_set(std::vector<VkDescriptorType> types,
             vkUpdateDescriptorSets(device, 1, &write_set, 0, nullptr);
         } break;
 
+        case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: {
+            VkDescriptorBufferInfo descriptor_buffer_info = {};
+            descriptor_buffer_info.buffer = allocator.get_buffer(name).buffer;
+            descriptor_buffer_info.offset = 0;
+            descriptor_buffer_info.range = VK_WHOLE_SIZE;
+
+            VkWriteDescriptorSet write_set = vk_boiler::write_descriptor_set(
+                &descriptor_buffer_info, set, i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+            vkUpdateDescriptorSets(device, 1, &write_set, 0, nullptr);
+        } break;
+
         case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE: {
+            allocated_img img = allocator.get_img(name);
+
+            /* a mip chain is written through its first level */
             VkDescriptorImageInfo descriptor_img_info = {};
-            descriptor_img_info.imageView = allocator.get_img(name).img_view;
+            descriptor_img_info.imageView =
+                img.mip_views.empty() ? img.img_view : img.mip_views[0];
             descriptor_img_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
             VkWriteDescriptorSet write_set = vk_boiler::write_descriptor_set(
@@ -134,6 +204,18 @@ void cs::write_descriptor_set(std::vector<VkDescriptorType> types,
             vkUpdateDescriptorSets(device, 1, &write_set, 0, nullptr);
         } break;
 
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: {
+            VkDescriptorImageInfo descriptor_img_info = {};
+            descriptor_img_info.sampler = allocator.get_sampler(name).sampler;
+            descriptor_img_info.imageView = allocator.get_img(name).img_view;
+            descriptor_img_info.imageLayout = allocator.get_sampler(name).layout;
+
+            VkWriteDescriptorSet write_set = vk_boiler::write_descriptor_set(
+                &descriptor_img_info, set, i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+            vkUpdateDescriptorSets(device, 1, &write_set, 0, nullptr);
+        } break;
+
         default:
             break;
         }
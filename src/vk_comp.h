@@ -1,12 +1,14 @@
 #pragma once
 
 #include <functional>
+#include <map>
 #include <utility>
 #include <vector>
 #include <volk.h>
 
 #include "vk_mem_alloc.h"
 
+#include "vk_descriptor.h"
 #include "vk_type.h"
 
 typedef std::pair<VkDescriptorType, std::string> descriptor;
@@ -17,6 +19,12 @@ struct comp_context {
     VkCommandBuffer cbuffer;
 };
 
+/* sampler of a combined image sampler, and the layout the image is sampled in */
+struct sampled_img {
+    VkSampler sampler;
+    VkImageLayout layout;
+};
+
 struct comp_allocator {
 public:
     VkDevice device;
@@ -30,12 +38,17 @@ public:
 
     void create_img(VkFormat format, VkExtent3D extent, VkImageAspectFlags aspect,
                     VkImageUsageFlags usage, VmaAllocationCreateFlags flags,
-                    std::string name);
+                    std::string name, uint32_t mip_levels = 1);
+
+    /* trilinear and repeating, for binding name as a combined image sampler */
+    void create_sampler(std::string name, uint32_t mip_levels, VkImageLayout layout);
 
     inline allocated_buffer get_buffer(std::string name) { return buffers[name]; };
 
     inline allocated_img get_img(std::string name) { return imgs[name]; };
 
+    inline sampled_img get_sampler(std::string name) { return samplers[name]; };
+
     void load_buffer(std::string name, allocated_buffer buffer)
     {
         buffers[name] = buffer;
@@ -43,17 +56,28 @@ public:
 
     void load_img(std::string name, allocated_img img) { imgs[name] = img; };
 
+    /* passes with the same types share a layout, the set is their own */
     void allocate_descriptor_set(std::vector<VkDescriptorType> types,
                                  VkDescriptorSetLayout *layout, VkDescriptorSet *set);
 
+    /* back to the pool, for passes removed at runtime once no frame uses it */
+    void free_descriptor_set(VkDescriptorSet set);
+
+    /* valid until frame comes around again, see reset_transient */
+    VkDescriptorSet allocate_transient_set(VkDescriptorSetLayout layout, uint32_t frame);
+
+    /* once the fence of frame is waited on */
+    static void reset_transient(uint32_t frame);
+
 private:
-    inline static std::vector<VkDescriptorPool> pools;
-    inline static std::vector<VkDescriptorPool> full_pools;
+    inline static descriptor_allocator descriptors;
+    inline static std::vector<descriptor_allocator> transient;
+    inline static std::map<std::vector<VkDescriptorType>, VkDescriptorSetLayout> layouts;
     inline static std::unordered_map<std::string, allocated_buffer> buffers;
     inline static std::unordered_map<std::string, allocated_img> imgs;
+    inline static std::unordered_map<std::string, sampled_img> samplers;
 
-    void create_new_pool();
-    VkDescriptorPool get_pool();
+    VkDescriptorSetLayout get_layout(const std::vector<VkDescriptorType> &types);
 };
 
 struct cs {
@@ -81,14 +105,23 @@ public:
 
     comp_allocator allocator;
 
+    std::string name;
     VkShaderModule module;
     VkDescriptorSet set;
     VkDescriptorSetLayout layout;
-    VkPipeline pipeline;
+    /* filled in by pipeline_queue, see vk_engine::_compiles */
+    VkPipeline *pipeline;
     VkPipelineLayout pipeline_layout;
 
     std::function<void(VkCommandBuffer, cs *cs)> draw;
 
+    /* run on the compute queue, outputs are handed back to graphics after */
+    bool async = false;
+    std::vector<std::string> outputs;
+
+    /* outputs keep their contents between frames, and return to compute */
+    bool persistent = false;
+
     static void cc_init(uint32_t queue_index, VkDevice device);
     static void comp_immediate_submit(VkDevice device, VkQueue queue, cs *cs);
 
@@ -107,3 +140,6 @@ private:
 };
 
 inline static std::vector<cs> css;
+
+/* recorded between the two halves of the scene draw, see draw_occlusion */
+inline static std::vector<cs> late_css;
@@ -0,0 +1,130 @@
+#include "vk_descriptor.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "vk_boiler.h"
+#include "vk_type.h"
+
+/* descriptors of each type per set, everything the shaders bind */
+static const std::vector<std::pair<VkDescriptorType, uint32_t>> ratios = {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1},
+    {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+};
+
+void descriptor_allocator::init(VkDevice device, uint32_t sets, bool free)
+{
+    this->device = device;
+    sets_per_pool = std::max(sets, 1u);
+    freeable = free;
+
+    ready.push_back(create_pool());
+}
+
+VkDescriptorSet descriptor_allocator::allocate(VkDescriptorSetLayout layout)
+{
+    VkDescriptorPool pool = get_pool();
+
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info =
+        vk_boiler::descriptor_set_allocate_info(pool, &layout);
+
+    VkDescriptorSet set;
+    VkResult result =
+        vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &set);
+
+    /* this pool is done until a reset, retry once with a fresh one */
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+        full.push_back(pool);
+        ready.pop_back();
+
+        pool = get_pool();
+        descriptor_set_allocate_info.descriptorPool = pool;
+        result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &set);
+    }
+
+    VK_CHECK(result);
+
+    if (freeable)
+        owners[set] = pool;
+
+    return set;
+}
+
+void descriptor_allocator::free(VkDescriptorSet set)
+{
+    auto owner = owners.find(set);
+    if (owner == owners.end())
+        return;
+
+    VkDescriptorPool pool = owner->second;
+    owners.erase(owner);
+
+    VK_CHECK(vkFreeDescriptorSets(device, pool, 1, &set));
+
+    /* room again, but behind the pools that never filled up */
+    auto f = std::find(full.begin(), full.end(), pool);
+    if (f != full.end()) {
+        full.erase(f);
+        ready.insert(ready.begin(), pool);
+    }
+}
+
+void descriptor_allocator::reset()
+{
+    for (VkDescriptorPool pool : full)
+        ready.push_back(pool);
+
+    full.clear();
+    owners.clear();
+
+    for (VkDescriptorPool pool : ready)
+        VK_CHECK(vkResetDescriptorPool(device, pool, 0));
+}
+
+void descriptor_allocator::destroy()
+{
+    for (VkDescriptorPool pool : ready)
+        vkDestroyDescriptorPool(device, pool, nullptr);
+
+    for (VkDescriptorPool pool : full)
+        vkDestroyDescriptorPool(device, pool, nullptr);
+
+    ready.clear();
+    full.clear();
+    owners.clear();
+}
+
+VkDescriptorPool descriptor_allocator::create_pool()
+{
+    std::vector<VkDescriptorPoolSize> pool_sizes;
+    for (auto [type, ratio] : ratios)
+        pool_sizes.push_back({type, ratio * sets_per_pool});
+
+    VkDescriptorPoolCreateInfo pool_info =
+        vk_boiler::descriptor_pool_create_info(pool_sizes.size(), pool_sizes.data());
+    pool_info.flags = freeable ? VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT : 0;
+    pool_info.maxSets = sets_per_pool;
+
+    VkDescriptorPool pool;
+    VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &pool));
+
+    return pool;
+}
+
+VkDescriptorPool descriptor_allocator::get_pool()
+{
+    if (!ready.empty())
+        return ready.back();
+
+    /* each new pool half again as large, they only run out at the start */
+    sets_per_pool = std::min(sets_per_pool + sets_per_pool / 2, MAX_SETS);
+    ready.push_back(create_pool());
+
+    return ready.back();
+}
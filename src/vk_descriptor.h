@@ -0,0 +1,54 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <volk.h>
+
+/*
+    Descriptor sets from a list of pools, a new and larger pool is added
+    whenever the ones there run out.
+
+        descriptor_allocator descriptors;
+        descriptors.init(device, 64, true);
+
+        VkDescriptorSet set = descriptors.allocate(layout);
+        ...
+        descriptors.free(set);      // only when created with free
+        descriptors.reset();        // every set at once, transient sets of a frame
+        descriptors.destroy();
+
+    every pool holds a few descriptors of each type a set may use per set, a
+    layout heavier than that only fits fewer sets into a pool.
+*/
+
+struct descriptor_allocator {
+public:
+    VkDevice device = VK_NULL_HANDLE;
+
+    /* free lets single sets go back, otherwise only reset does */
+    void init(VkDevice device, uint32_t sets, bool free = false);
+
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+    void free(VkDescriptorSet set);
+
+    /* sets allocated so far are invalid afterwards, the pools are kept */
+    void reset();
+
+    void destroy();
+
+private:
+    static constexpr uint32_t MAX_SETS = 4096;
+
+    uint32_t sets_per_pool = 0;
+    bool freeable = false;
+
+    std::vector<VkDescriptorPool> ready;
+    std::vector<VkDescriptorPool> full;
+
+    /* pool of every live set, for free */
+    std::unordered_map<VkDescriptorSet, VkDescriptorPool> owners;
+
+    VkDescriptorPool create_pool();
+    VkDescriptorPool get_pool();
+};
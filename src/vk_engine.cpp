@@ -1,5 +1,6 @@
 ﻿#include "vk_engine.h"
 
+#include <cstring>
 #include <future>
 #include <iostream>
 #include <vector>
@@ -22,18 +23,23 @@
 
 #include "vk_boiler.h"
 #include "vk_cmd.h"
+#include "vk_comp.h"
 #include "vk_pipeline.h"
 #include "vk_type.h"
 
 void vk_engine::init()
 {
     /* initialize SDL and create a window with it */
-    SDL_Init(SDL_INIT_VIDEO);
+    if (_headless) {
+        SDL_Init(0);
+    } else {
+        SDL_Init(SDL_INIT_VIDEO);
 
-    _window = SDL_CreateWindow("vk_engine", _window_extent.width, _window_extent.height,
-                               SDL_WINDOW_VULKAN);
+        _window = SDL_CreateWindow("vk_engine", _window_extent.width,
+                                   _window_extent.height, SDL_WINDOW_VULKAN);
 
-    deletion_queue.push_back([=]() { SDL_DestroyWindow(_window); });
+        deletion_queue.push_back([=]() { SDL_DestroyWindow(_window); });
+    }
 
     device_init();
 
@@ -84,19 +90,40 @@ void vk_engine::init()
     swapchain_init();
     command_init();
     sync_init();
+    profiler_init();
+    uniform_init();
+    upload_init();
+    pipeline_cache_init();
+    _compiles.start(_device, _pipeline_cache);
 
     descriptor_init();
     pipeline_init();
 
     imgui_init();
 
-    // load_meshes();
-    // std::cout << "meshes size " << _meshes.size() << std::endl;
-    // upload_meshes(_meshes.data(), _meshes.size());
-    // upload_textures(_meshes.data(), _meshes.size());
+    if (_scene) {
+        load_meshes();
+        arena_init();
+        upload_meshes(_meshes.data(), _meshes.size());
+        upload_textures(_meshes.data(), _meshes.size());
+
+        if (_indirect)
+            upload_draws();
+
+        /* the first frame acquires what the copies released, they must be done */
+        _uploads.flush();
+    }
 
     comp_init();
 
+    /* the rest were compiling alongside the passes' resources and noise */
+    _compiles.finish();
+
+    if (_cache_stats)
+        std::cout << "pipeline cache: " << PipelineBuilder::_cache_hits << " hits, "
+                  << PipelineBuilder::_cache_misses << " misses, "
+                  << PipelineBuilder::_create_ms << " ms" << std::endl;
+
     _is_initialized = true;
 }
 
@@ -106,6 +133,7 @@ void vk_engine::descriptor_init()
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 256},
         {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 256},
         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 256},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 256},
     };
 
     VkDescriptorPoolCreateInfo pool_info =
@@ -153,6 +181,92 @@ void vk_engine::descriptor_init()
         deletion_queue.push_back(
             [=]() { vkDestroyDescriptorSetLayout(_device, _texture_layout, nullptr); });
     }
+
+    if (_indirect) { /* per draw data, indexed by gl_DrawID */
+        VkDescriptorSetLayoutCreateInfo draw_layout_info =
+            vk_boiler::descriptor_set_layout_create_info(
+                std::vector<VkDescriptorType>{
+                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                },
+                VK_SHADER_STAGE_VERTEX_BIT);
+
+        VK_CHECK(vkCreateDescriptorSetLayout(_device, &draw_layout_info, nullptr,
+                                             &_draw_layout));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroyDescriptorSetLayout(_device, _draw_layout, nullptr); });
+
+        VkDescriptorSetAllocateInfo descriptor_set_allocate_info =
+            vk_boiler::descriptor_set_allocate_info(_descriptor_pool, &_draw_layout);
+
+        VK_CHECK(vkAllocateDescriptorSets(_device, &descriptor_set_allocate_info,
+                                          &_draw_set));
+    }
+
+    if (!_bindless)
+        return;
+
+    { /* bindless texture array, written as textures are uploaded */
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        binding.descriptorCount = _max_textures;
+        binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorBindingFlags binding_flags =
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info = {};
+        binding_flags_info.sType =
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        binding_flags_info.pNext = nullptr;
+        binding_flags_info.bindingCount = 1;
+        binding_flags_info.pBindingFlags = &binding_flags;
+
+        VkDescriptorSetLayoutCreateInfo bindless_layout_info = {};
+        bindless_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        bindless_layout_info.pNext = &binding_flags_info;
+        bindless_layout_info.flags =
+            VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        bindless_layout_info.bindingCount = 1;
+        bindless_layout_info.pBindings = &binding;
+
+        VK_CHECK(vkCreateDescriptorSetLayout(_device, &bindless_layout_info, nullptr,
+                                             &_bindless_layout));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroyDescriptorSetLayout(_device, _bindless_layout, nullptr); });
+
+        VkDescriptorPoolSize bindless_size = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                              _max_textures};
+
+        VkDescriptorPoolCreateInfo bindless_pool_info =
+            vk_boiler::descriptor_pool_create_info(1, &bindless_size);
+        bindless_pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        bindless_pool_info.maxSets = 1;
+
+        VK_CHECK(vkCreateDescriptorPool(_device, &bindless_pool_info, nullptr,
+                                        &_bindless_pool));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroyDescriptorPool(_device, _bindless_pool, nullptr); });
+
+        VkDescriptorSetVariableDescriptorCountAllocateInfo count_info = {};
+        count_info.sType =
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+        count_info.pNext = nullptr;
+        count_info.descriptorSetCount = 1;
+        count_info.pDescriptorCounts = &_max_textures;
+
+        VkDescriptorSetAllocateInfo descriptor_set_allocate_info =
+            vk_boiler::descriptor_set_allocate_info(_bindless_pool, &_bindless_layout);
+        descriptor_set_allocate_info.pNext = &count_info;
+
+        VK_CHECK(vkAllocateDescriptorSets(_device, &descriptor_set_allocate_info,
+                                          &_bindless_set));
+    }
 }
 
 void vk_engine::pipeline_init()
@@ -163,10 +277,28 @@ void vk_engine::pipeline_init()
     constexpr uint32_t kFragSpv[] = {
 #include <shader/.frag.u32>
 	};
+    constexpr uint32_t kBindlessFragSpv[] = {
+#include <shader/bindless.frag.u32>
+	};
+    constexpr uint32_t kIndirectVertSpv[] = {
+#include <shader/indirect.vert.u32>
+	};
+    constexpr uint32_t kIndirectFragSpv[] = {
+#include <shader/indirect.frag.u32>
+	};
     
     /* build graphics pipeline */
-    load_shader_module(kVertSpv, sizeof(kVertSpv), &_vert);
-    load_shader_module(kFragSpv, sizeof(kFragSpv), &_frag);
+    if (_indirect)
+        load_shader_module(kIndirectVertSpv, sizeof(kIndirectVertSpv), &_vert);
+    else
+        load_shader_module(kVertSpv, sizeof(kVertSpv), &_vert);
+
+    if (_indirect)
+        load_shader_module(kIndirectFragSpv, sizeof(kIndirectFragSpv), &_frag);
+    else if (_bindless)
+        load_shader_module(kBindlessFragSpv, sizeof(kBindlessFragSpv), &_frag);
+    else
+        load_shader_module(kFragSpv, sizeof(kFragSpv), &_frag);
 
     PipelineBuilder gfx_pipeline_builder = {};
     gfx_pipeline_builder._shader_stage_infos.push_back(
@@ -177,10 +309,10 @@ void vk_engine::pipeline_init()
     gfx_pipeline_builder._viewport = vk_boiler::viewport(_resolution);
     gfx_pipeline_builder._scissor = vk_boiler::scissor(_resolution);
 
-    vertex_input_description description = vertex::get_vertex_input_description();
+    _vertex_description = vertex::get_vertex_input_description();
 
     gfx_pipeline_builder._vertex_input_state_info =
-        vk_boiler::vertex_input_state_create_info(&description);
+        vk_boiler::vertex_input_state_create_info(&_vertex_description);
     gfx_pipeline_builder._input_asm_state_info =
         vk_boiler::input_asm_state_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
     gfx_pipeline_builder._rasterization_state_info =
@@ -194,16 +326,28 @@ void vk_engine::pipeline_init()
 
     std::vector<VkDescriptorSetLayout> layouts = {
         _render_mat_layout,
-        _texture_layout,
+        _bindless ? _bindless_layout : _texture_layout,
     };
 
+    if (_indirect)
+        layouts.push_back(_draw_layout);
+
     std::vector<VkPushConstantRange> push_constants = {};
 
+    /* which element of the texture array the draw samples, DRAWS has it instead */
+    if (_bindless && !_indirect) {
+        VkPushConstantRange u_material = {};
+        u_material.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        u_material.offset = 0;
+        u_material.size = sizeof(uint32_t);
+        push_constants.push_back(u_material);
+    }
+
     gfx_pipeline_builder.build_layout(_device, layouts, push_constants,
                                         &_gfx_pipeline_layout);
 
-    gfx_pipeline_builder.build_gfx(_device, &_format, _depth_img.format,
-                                    &_gfx_pipeline_layout, &_gfx_pipeline);
+    _gfx_pipeline = _compiles.build_gfx(gfx_pipeline_builder, _format, _depth_img.format,
+                                        _gfx_pipeline_layout);
 }
 
 void vk_engine::draw()
@@ -213,9 +357,18 @@ void vk_engine::draw()
     VK_CHECK(vkWaitForFences(_device, 1, &frame->fence, VK_TRUE, UINT64_MAX));
     VK_CHECK(vkResetFences(_device, 1, &frame->fence));
 
+    free_retired();
+
+    /* nothing in flight reads the sets this slot allocated last time */
+    comp_allocator::reset_transient(_frame_index);
+    _uniforms.begin_frame(_frame_index);
+
+    _time = _fixed_dt > 0.f ? _frame_number * _fixed_dt : SDL_GetTicks() / 1000.f;
+
     /* wait and acquire the next frame */
-    vkAcquireNextImageKHR(_device, _swapchain, UINT64_MAX, frame->present_sem,
-                          VK_NULL_HANDLE, &_img_index);
+    if (!_headless)
+        vkAcquireNextImageKHR(_device, _swapchain, UINT64_MAX, frame->present_sem,
+                              VK_NULL_HANDLE, &_img_index);
 
     /* prepare command buffer and dynamic rendering functions */
     VkCommandBufferBeginInfo cbuffer_begin_info = vk_boiler::cbuffer_begin_info();
@@ -223,11 +376,20 @@ void vk_engine::draw()
     /* begin command buffer recording */
     VK_CHECK(vkBeginCommandBuffer(frame->cbuffer, &cbuffer_begin_info));
 
+    /* results of this frame slot are ready since its fence was waited on */
+    _profiler.begin_frame(frame->cbuffer, _frame_index, _frame_number);
+    uint32_t frame_query = _profiler.begin(frame->cbuffer, "frame");
+
     /* transition image format for rendering */
     vk_cmd::vk_img_layout_transition(
         frame->cbuffer, _target.img, VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, _gfx_index);
 
+    /* cleared by the draw, the previous contents can go */
+    vk_cmd::vk_depth_layout_transition(
+        frame->cbuffer, _depth_img.img, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, _gfx_index);
+
     /* draw with comp */
     draw_comp(frame);
 
@@ -246,15 +408,67 @@ void vk_engine::draw()
 
     vkCmdBeginRendering(frame->cbuffer, &rendering_info);
 
-    // draw_nodes(frame);
+    if (_scene && _indirect && _cull)
+        draw_indirect(frame, _visible_commands.buffer, _visible_count.buffer);
+    else if (_scene && _indirect)
+        draw_indirect(frame, _draw_commands.buffer, VK_NULL_HANDLE);
+    else if (_scene)
+        draw_nodes(frame);
+
+    /* the early half is in the depth, build the pyramid and draw what it missed */
+    if (_scene && _occlusion && _draw_count) {
+        vkCmdEndRendering(frame->cbuffer);
+
+        draw_occlusion(frame);
+
+        color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        vkCmdBeginRendering(frame->cbuffer, &rendering_info);
+
+        draw_indirect(frame, _late_commands.buffer, _late_count.buffer);
+    }
+
+    /* gpu time per pass, averaged over the last frames */
+    if (_profiler.enabled) {
+        ImGui::Begin("profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        for (const pass_stat &stat : _profiler.get_stats())
+            ImGui::Text("%-10s %.3f ms", stat.name.c_str(), stat.avg_ms);
+        ImGui::End();
+    }
 
     /* imgui rendering */
     // ImGui::ShowDemoWindow();
     ImGui::Render();
+
+    uint32_t imgui_query = _profiler.begin(frame->cbuffer, "imgui");
     ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), frame->cbuffer);
+    _profiler.end(frame->cbuffer, imgui_query);
 
     vkCmdEndRendering(frame->cbuffer);
 
+    if (_headless) {
+        /* leave the frame in _target, optionally copied out for the host */
+        if (_readback) {
+            vk_cmd::vk_img_layout_transition(
+                frame->cbuffer, _target.img, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _transfer_index);
+
+            uint32_t readback_query = _profiler.begin(frame->cbuffer, "readback");
+            vk_cmd::vk_img_buffer_copy(
+                frame->cbuffer, VkExtent3D{_resolution.width, _resolution.height, 1},
+                _target.img, frame->readback.buffer);
+            _profiler.end(frame->cbuffer, readback_query);
+        }
+
+        _profiler.end(frame->cbuffer, frame_query);
+        VK_CHECK(vkEndCommandBuffer(frame->cbuffer));
+
+        submit_gfx(frame);
+
+        _frame_number++;
+        return;
+    }
+
     /* transition image format for transfering */
     vk_cmd::vk_img_layout_transition(
         frame->cbuffer, _target.img, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
@@ -282,24 +496,22 @@ void vk_engine::draw()
     //                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
 
     /* only apply to window extent == resolution */
+    uint32_t copy_query = _profiler.begin(frame->cbuffer, "copy");
     vk_cmd::vk_img_copy(frame->cbuffer,
                         VkExtent3D{_window_extent.width, _window_extent.height, 1},
                         _target.img, _swapchain_imgs[_img_index]);
+    _profiler.end(frame->cbuffer, copy_query);
 
     /* transition image format for presenting */
     vk_cmd::vk_img_layout_transition(frame->cbuffer, _swapchain_imgs[_img_index],
                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, _gfx_index);
 
+    _profiler.end(frame->cbuffer, frame_query);
     VK_CHECK(vkEndCommandBuffer(frame->cbuffer));
 
     /* submit present queue */
-    VkPipelineStageFlags pipeline_stage_flags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-    VkSubmitInfo submit_info = vk_boiler::submit_info(
-        &frame->cbuffer, &frame->present_sem, &frame->sumbit_sem, &pipeline_stage_flags);
-
-    VK_CHECK(vkQueueSubmit(_gfx_queue, 1, &submit_info, frame->fence));
+    submit_gfx(frame);
 
     VkPresentInfoKHR present_info =
         vk_boiler::present_info(&_swapchain, &frame->sumbit_sem, &_img_index);
@@ -309,64 +521,226 @@ void vk_engine::draw()
     _frame_number++;
 }
 
+void vk_engine::submit_gfx(frame *frame)
+{
+    /* swapchain image and async compute of this frame, whichever are in use */
+    std::vector<VkSemaphore> wait_sems;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    std::vector<VkSemaphore> signal_sems;
+
+    if (!_headless) {
+        wait_sems.push_back(frame->present_sem);
+        wait_stages.push_back(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        signal_sems.push_back(frame->sumbit_sem);
+    }
+
+    /* gfx_sem lets the next frame's async passes overwrite what this one read */
+    if (frame->comp_submitted) {
+        wait_sems.push_back(frame->comp_sem);
+        wait_stages.push_back(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        signal_sems.push_back(frame->gfx_sem);
+
+        _comp_wait_sem = frame->gfx_sem;
+        frame->comp_submitted = false;
+    }
+
+    VkSubmitInfo submit_info = vk_boiler::submit_info(
+        &frame->cbuffer, wait_sems.data(), signal_sems.data(), wait_stages.data());
+
+    submit_info.waitSemaphoreCount = wait_sems.size();
+    submit_info.signalSemaphoreCount = signal_sems.size();
+
+    VK_CHECK(vkQueueSubmit(_gfx_queue, 1, &submit_info, frame->fence));
+}
+
 void vk_engine::draw_nodes(frame *frame)
 {
-    std::vector<node> nodes(_nodes);
+    /* nothing moves yet, a no-op after the first frame */
+    _graph.update();
+
+    render_mat mat;
+    mat.view = _vk_camera.get_view_mat();
+    mat.proj = _vk_camera.get_proj_mat();
+    mat.proj[1][1] *= -1;
 
-    for (uint32_t i = 0; i < nodes.size(); ++i) {
-        node *node = &nodes[i];
+    vkCmdBindPipeline(frame->cbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *_gfx_pipeline);
 
-        for (auto c = node->children.cbegin(); c != node->children.cend(); ++c)
-            nodes[*c].transform_mat = node->transform_mat * nodes[*c].transform_mat;
+    /* the texture array stays bound, draws only move the render_mat offset */
+    if (_bindless)
+        vkCmdBindDescriptorSets(frame->cbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                _gfx_pipeline_layout, 1, 1, &_bindless_set, 0, nullptr);
 
-        if (node->mesh_id != -1) {
-            mesh *mesh = &_meshes[node->mesh_id];
-            vkCmdBindPipeline(frame->cbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              _gfx_pipeline);
+    /* meshes share the arena's buffers, rebound only when the block changes */
+    uint32_t bound_block = NO_BLOCK;
 
-            VkDeviceSize offset = 0;
-            vkCmdBindVertexBuffers(frame->cbuffer, 0, 1, &mesh->vertex_buffer.buffer,
-                                   &offset);
+    for (uint32_t i = 0; i < _graph.size(); ++i) {
+        if (_graph.mesh_ids[i] != NO_MESH) {
+            mesh *mesh = &_meshes[_graph.mesh_ids[i]];
 
-            vkCmdBindIndexBuffer(frame->cbuffer, mesh->index_buffer.buffer, 0,
-                                 VK_INDEX_TYPE_UINT16);
+            /* unloaded, or nothing to draw */
+            if (mesh->range.block == NO_BLOCK)
+                continue;
 
-            render_mat mat;
-            mat.view = _vk_camera.get_view_mat();
-            mat.proj = _vk_camera.get_proj_mat();
-            mat.proj[1][1] *= -1;
-            mat.model = node->transform_mat;
+            if (mesh->range.block != bound_block) {
+                bound_block = mesh->range.block;
 
-            void *data;
-            vmaMapMemory(_allocator, _render_mat_buffer.allocation, &data);
-            std::memcpy((char *)data + i * pad_uniform_buffer_size(sizeof(render_mat)),
-                        &mat, sizeof(render_mat));
-            vmaUnmapMemory(_allocator, _render_mat_buffer.allocation);
+                VkBuffer vertex_buffer = _arena.vertex_buffer(bound_block);
+                VkDeviceSize offset = 0;
+                vkCmdBindVertexBuffers(frame->cbuffer, 0, 1, &vertex_buffer, &offset);
 
-            std::vector<VkDescriptorSet> sets = {
+                vkCmdBindIndexBuffer(frame->cbuffer, _arena.index_buffer(bound_block), 0,
+                                     VK_INDEX_TYPE_UINT16);
+            }
+
+            mat.model = _graph.worlds[i];
+
+            VkDescriptorSet sets[] = {
                 _render_mat_set,
                 mesh->texture_set,
             };
-            uint32_t doffset = i * pad_uniform_buffer_size(sizeof(render_mat));
+            uint32_t doffset = _uniforms.push(&mat, sizeof(render_mat));
             vkCmdBindDescriptorSets(frame->cbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                    _gfx_pipeline_layout, 0, sets.size(), sets.data(), 1,
+                                    _gfx_pipeline_layout, 0, _bindless ? 1 : 2, sets, 1,
                                     &doffset);
 
-            vkCmdDrawIndexed(frame->cbuffer, mesh->indices.size(), 1, 0, 0, 0);
+            if (_bindless)
+                vkCmdPushConstants(frame->cbuffer, _gfx_pipeline_layout,
+                                   VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t),
+                                   &mesh->texture_id);
+
+            vkCmdDrawIndexed(frame->cbuffer, mesh->range.index_count, 1,
+                             mesh->range.first_index, mesh->range.first_vertex, 0);
         }
     }
 }
 
+void vk_engine::draw_indirect(frame *frame, VkBuffer commands, VkBuffer count)
+{
+    if (_draw_count == 0)
+        return;
+
+    /* view and proj only, every model matrix is in _draw_data */
+    render_mat mat = {};
+    mat.view = _vk_camera.get_view_mat();
+    mat.proj = _vk_camera.get_proj_mat();
+    mat.proj[1][1] *= -1;
+
+    vkCmdBindPipeline(frame->cbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *_gfx_pipeline);
+
+    VkDescriptorSet sets[] = {
+        _render_mat_set,
+        _bindless_set,
+        _draw_set,
+    };
+    uint32_t doffset = _uniforms.push(&mat, sizeof(render_mat));
+    vkCmdBindDescriptorSets(frame->cbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            _gfx_pipeline_layout, 0, 3, sets, 1, &doffset);
+
+    /* arena_init sized the first block to hold the whole scene */
+    VkBuffer vertex_buffer = _arena.vertex_buffer(0);
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(frame->cbuffer, 0, 1, &vertex_buffer, &offset);
+    vkCmdBindIndexBuffer(frame->cbuffer, _arena.index_buffer(0), 0, VK_INDEX_TYPE_UINT16);
+
+    /* a count from cull.comp, _draw_count at most */
+    if (count)
+        vkCmdDrawIndexedIndirectCount(frame->cbuffer, commands, 0, count, 0, _draw_count,
+                                      sizeof(VkDrawIndexedIndirectCommand));
+    else
+        vkCmdDrawIndexedIndirect(frame->cbuffer, commands, 0, _draw_count,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+}
+
+bool vk_engine::read_target(std::vector<unsigned char> &pixels)
+{
+    if (!_headless || !_readback || !_frame_number)
+        return false;
+
+    /* the last submitted frame, wait without resetting so draw() still can */
+    frame *frame = &_frames[(_frame_number - 1) % FRAME_OVERLAP];
+    VK_CHECK(vkWaitForFences(_device, 1, &frame->fence, VK_TRUE, UINT64_MAX));
+
+    pixels.resize(frame->readback.size);
+
+    void *data;
+    vmaMapMemory(_allocator, frame->readback.allocation, &data);
+    vmaInvalidateAllocation(_allocator, frame->readback.allocation, 0, VK_WHOLE_SIZE);
+    std::memcpy(pixels.data(), data, pixels.size());
+    vmaUnmapMemory(_allocator, frame->readback.allocation);
+
+    return true;
+}
+
+/* level 0 of a comp_allocator image in GENERAL, left in GENERAL after */
+bool vk_engine::read_img(std::string name, uint32_t texel_size,
+                         std::vector<char> &texels)
+{
+    /* the upload context is on _transfer_queue, it has to own the image */
+    if (_transfer_index != _gfx_index || _comp_index != _gfx_index)
+        return false;
+
+    comp_allocator allocator(_device, _allocator);
+    allocated_img img = allocator.get_img(name);
+
+    if (!img.img)
+        return false;
+
+    size_t size = (size_t)img.extent.width * img.extent.height * img.extent.depth *
+                  texel_size;
+
+    /* not through create_buffer, it is gone before cleanup */
+    VkBufferCreateInfo staging_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    staging_info.size = size;
+    staging_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VmaAllocationCreateInfo vma_allocation_info = {};
+    vma_allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+    vma_allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+
+    allocated_buffer staging_buffer = {};
+    VK_CHECK(vmaCreateBuffer(_allocator, &staging_info, &vma_allocation_info,
+                             &staging_buffer.buffer, &staging_buffer.allocation,
+                             nullptr));
+    staging_buffer.size = size;
+
+    immediate_submit([&](VkCommandBuffer cbuffer) {
+        vk_cmd::vk_img_layout_transition(cbuffer, img.img, VK_IMAGE_LAYOUT_GENERAL,
+                                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                         _gfx_index);
+
+        vk_cmd::vk_img_buffer_copy(cbuffer, img.extent, img.img, staging_buffer.buffer);
+
+        vk_cmd::vk_img_layout_transition(cbuffer, img.img,
+                                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                         VK_IMAGE_LAYOUT_GENERAL, _gfx_index);
+    });
+
+    texels.resize(size);
+
+    void *data;
+    vmaMapMemory(_allocator, staging_buffer.allocation, &data);
+    vmaInvalidateAllocation(_allocator, staging_buffer.allocation, 0, VK_WHOLE_SIZE);
+    std::memcpy(texels.data(), data, size);
+    vmaUnmapMemory(_allocator, staging_buffer.allocation);
+
+    vmaDestroyBuffer(_allocator, staging_buffer.buffer, staging_buffer.allocation);
+
+    return true;
+}
+
 void vk_engine::cleanup()
 {
     vkDeviceWaitIdle(_device);
 
     ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplSDL3_Shutdown();
+    if (!_headless)
+        ImGui_ImplSDL3_Shutdown();
     ImGui::DestroyContext();
 
-    if (_is_initialized)
+    if (_is_initialized) {
+        pipeline_cache_write();
         deletion_queue.flush();
+    }
 }
 
 void vk_engine::run()
@@ -375,12 +749,24 @@ void vk_engine::run()
     bool bquit = false;
 
     uint32_t triangles = 0;
-    for (uint32_t i = 0; i < _nodes.size(); ++i) {
-        if (_nodes[i].mesh_id != -1)
-            triangles += _meshes[_nodes[i].mesh_id].indices.size() / 3;
+    for (uint32_t i = 0; i < _graph.size(); ++i) {
+        if (_graph.mesh_ids[i] != NO_MESH)
+            triangles += _meshes[_graph.mesh_ids[i]].indices.size() / 3;
     }
 
     // std::cout << "draw " << triangles << " triangels" << std::endl;
+
+    /* no input to poll, just render the requested number of frames */
+    if (_headless) {
+        uint64_t frames = _max_frames ? _max_frames : 1;
+
+        for (uint64_t i = 0; i < frames; ++i) {
+            new_frame();
+            draw();
+        }
+
+        return;
+    }
     
     SDL_SetWindowRelativeMouseMode(_window, true);
     //SDL_SetRelativeMouseMode(true);
@@ -439,14 +825,29 @@ void vk_engine::run()
     });
 
     while (!bquit) {
-        ImGui_ImplVulkan_NewFrame();
-        ImGui_ImplSDL3_NewFrame();
-        ImGui::NewFrame();
-
+        new_frame();
         draw();
+
+        if (_max_frames && _frame_number >= _max_frames)
+            bquit = true;
     }
 }
 
+void vk_engine::new_frame()
+{
+    ImGui_ImplVulkan_NewFrame();
+
+    if (_headless) {
+        /* what the SDL backend would otherwise fill in for us */
+        ImGuiIO &io = ImGui::GetIO();
+        io.DisplaySize = ImVec2((float)_resolution.width, (float)_resolution.height);
+        io.DeltaTime = 1.f / 60.f;
+    } else
+        ImGui_ImplSDL3_NewFrame();
+
+    ImGui::NewFrame();
+}
+
 void vk_engine::imgui_init()
 {
     /* Setup Dear ImGui context */
@@ -466,13 +867,15 @@ void vk_engine::imgui_init()
     // rendering_info.stencilAttachmentFormat = ;
 
     /* Setup Platform/Renderer backends */
-    ImGui_ImplSDL3_InitForVulkan(_window);
+    if (!_headless)
+        ImGui_ImplSDL3_InitForVulkan(_window);
     ImGui_ImplVulkan_InitInfo imgui_init_info = {};
     imgui_init_info.Instance = _instance;
     imgui_init_info.PhysicalDevice = _physical_device;
     imgui_init_info.Device = _device;
     imgui_init_info.QueueFamily = _gfx_index;
     imgui_init_info.Queue = _gfx_queue;
+    imgui_init_info.PipelineCache = _pipeline_cache;
     imgui_init_info.DescriptorPool = _descriptor_pool;
     imgui_init_info.MinImageCount = 2;
     imgui_init_info.ImageCount = 2;
@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include <string>
 #include <vector>
 #include <volk.h>
 
@@ -8,16 +9,54 @@
 #include <glm/vec4.hpp>
 
 #include "vk_camera.h"
+#include "vk_cloud.h"
 #include "vk_mesh.h"
+#include "vk_pipeline.h"
+#include "vk_profiler.h"
+#include "vk_ring.h"
+#include "vk_tune.h"
 #include "vk_type.h"
+#include "vk_upload.h"
 
 constexpr int FRAME_OVERLAP = 2;
 
+struct cs;
+
 struct frame {
     VkFence fence;
     VkSemaphore sumbit_sem, present_sem;
     VkCommandPool cpool;
     VkCommandBuffer cbuffer;
+    allocated_buffer readback;
+
+    /* async passes, submitted to _comp_queue ahead of cbuffer */
+    VkCommandPool comp_cpool;
+    VkCommandBuffer comp_cbuffer;
+    VkSemaphore comp_sem, gfx_sem;
+    bool comp_submitted;
+};
+
+/* released by another queue family, acquired by the next graphics submit */
+struct ownership_transfer {
+    VkImage img;
+    VkBuffer buffer;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    uint32_t src_index;
+};
+
+/* mip chain to blit on the graphics queue, left in layout after */
+struct mip_build {
+    VkImage img;
+    VkExtent3D extent;
+    uint32_t mip_levels;
+    VkImageLayout layout;
+};
+
+/* arena range of an unloaded mesh, freed once frame is no longer in flight */
+struct retired_range {
+    arena_range range;
+    uint64_t frame;
 };
 
 struct upload_context {
@@ -48,6 +87,100 @@ public:
     VkExtent2D _resolution = { 1024, 768 };
     struct SDL_Window *_window = nullptr;
 
+    /* headless renders into _target only, no window, surface or swapchain */
+    bool _headless = false;
+    bool _readback = false;
+    uint64_t _max_frames = 0;
+
+    /* compute and transfer on the graphics queue, every image stays readable */
+    bool _single_queue = false;
+
+    /* seconds fed to animated passes, _fixed_dt > 0 steps it per frame */
+    float _time = 0.f;
+    float _fixed_dt = 0.f;
+
+    cloud_data _cloud_data;
+    camera_data _camera_data;
+
+    /* trace 1 of every 4x4 pixels a frame, reproject the rest from history */
+    bool _temporal = false;
+    bool _history_valid = false;
+    camera_data _camera_prev;
+
+    /* trace clouds at 1 / _cloud_scale resolution, upsample.comp brings it back */
+    uint32_t _cloud_scale = 1;
+
+    /* sample cloudtex and weather filtered and mipmapped instead of imageLoad */
+    bool _sampled = false;
+
+    uint32_t _cloudtex_size = 128;
+    uint32_t _weather_size = 512;
+
+    /* cloudtex is read from here when it matches, written after generating it */
+    const char *_noise_cache = "cloudtex.cache";
+
+    /*
+        _weather_cache generates a periodic map once and scrolls it in cloud.comp,
+        refreshing at most _weather_tiles tiles per frame instead of all of it
+    */
+    bool _weather_cache = true;
+    uint32_t _weather_tiles = 4;
+    uint32_t _weather_tile = 0;
+    float _weather_epoch = 0.f;
+    uint64_t _weather_version = 0;
+
+    /*
+        sun transmittance volume, rebuilt whole when cloud_data or the sun
+        changes and _light_slabs slabs a frame at a time when weather does
+    */
+    uint32_t _light_slabs = 4;
+    uint32_t _light_slab = 0;
+    uint64_t _light_version = 0;
+    bool _light_valid = false;
+    cloud_data _light_cloud;
+
+    /* specialized into light.comp and weather.comp */
+    uint32_t _light_steps = 6;
+    uint32_t _weather_octaves = 16;
+
+    /*
+        cloud workgroup shape, candidates are timed over the first frames when
+        _tune_cache has none for this device, or every run with _retune
+    */
+    const char *_tune_cache = "tune.cache";
+    bool _retune = false;
+    vk_tune::tuner _cloud_tuner;
+
+    /* glTF binary drawn along with the clouds, none by default */
+    const char *_scene = nullptr;
+
+    /*
+        _bindless keeps every mesh texture in one descriptor array, bound once a
+        frame and indexed by a push constant instead of a set per mesh
+    */
+    bool _bindless = false;
+    uint32_t _max_textures = 4096;
+    uint32_t _texture_count = 0;
+
+    /*
+        _indirect packs every mesh into one vertex and index buffer and draws
+        the scene with a single vkCmdDrawIndexedIndirect, implies _bindless
+    */
+    bool _indirect = false;
+    uint32_t _draw_count = 0;
+
+    /* cull.comp drops the draws outside the frustum before the indirect draw */
+    bool _cull = true;
+
+    /*
+        _occlusion splits the scene draw in two. The draws visible last frame
+        go first, a min/max depth pyramid is built from their depth and every
+        draw is tested against it, the newly visible are drawn after.
+    */
+    bool _occlusion = false;
+    VkExtent2D _pyramid_extent;
+    uint32_t _pyramid_levels = 1;
+
     VkInstance _instance;
     VkDebugUtilsMessengerEXT _debug_utils_messenger;
     VkPhysicalDevice _physical_device;
@@ -67,8 +200,22 @@ public:
     VkDescriptorPool _descriptor_pool;
     VkDescriptorSetLayout _render_mat_layout;
     VkDescriptorSet _render_mat_set;
-    allocated_buffer _render_mat_buffer;
+
+    /* per-frame uniforms, bound at the offset push returned this frame */
+    uniform_ring _uniforms;
+    VkDeviceSize _uniform_ring_size = 1 << 20;
+    uint32_t _camera_offset = 0;
+    uint32_t _cloud_offset = 0;
+
+    /* staging copies of the scene, submitted in batches instead of one by one */
+    upload_batcher _uploads;
+    VkDeviceSize _staging_size = 64 << 20;
     VkDescriptorSetLayout _texture_layout;
+    VkDescriptorPool _bindless_pool;
+    VkDescriptorSetLayout _bindless_layout;
+    VkDescriptorSet _bindless_set;
+    VkDescriptorSetLayout _draw_layout;
+    VkDescriptorSet _draw_set;
 
     VkQueue _gfx_queue;
     uint32_t _gfx_index;
@@ -77,16 +224,41 @@ public:
     VkQueue _comp_queue;
     uint32_t _comp_index;
 
+    /* _comp_queue is its own family, async passes overlap the graphics queue */
+    bool _async_comp = false;
+    VkSemaphore _comp_wait_sem = VK_NULL_HANDLE;
+    std::vector<ownership_transfer> _acquires;
+    std::vector<VkImage> _comp_acquires;
+    std::vector<mip_build> _mip_builds;
+
     VmaAllocator _allocator;
     std::vector<mesh> _meshes;
-    std::vector<node> _nodes;
+    scene_graph _graph;
+
+    /* vertices and indices of every mesh, blocks of this many more when full */
+    mesh_arena _arena;
+    uint32_t _arena_vertices = 1 << 18;
+    uint32_t _arena_indices = 1 << 20;
+    std::vector<retired_range> _retired_ranges;
+
+    allocated_buffer _draw_commands;
+    allocated_buffer _draw_data;
+    allocated_buffer _draw_bounds;
+    allocated_buffer _visible_commands;
+    allocated_buffer _visible_count;
+    allocated_buffer _late_commands;
+    allocated_buffer _late_count;
+    allocated_buffer _draw_visibility;
 
     VkShaderModule _vert;
     VkShaderModule _frag;
 
-    VkPipeline _gfx_pipeline;
+    VkPipeline *_gfx_pipeline;
     VkPipelineLayout _gfx_pipeline_layout;
 
+    /* read by the worker compiling _gfx_pipeline, after pipeline_init returns */
+    vertex_input_description _vertex_description;
+
     VkFormat _format = VK_FORMAT_B8G8R8A8_UNORM;
     VkColorSpaceKHR _colorspace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
 
@@ -95,6 +267,18 @@ public:
 
     vk_camera _vk_camera;
 
+    gpu_profiler _profiler;
+    const char *_profile_path = nullptr;
+
+    /* compiled pipelines, read at init and written at cleanup when it matches */
+    const char *_pipeline_cache_path = "pipeline.cache";
+    VkPipelineCache _pipeline_cache = VK_NULL_HANDLE;
+    /* hits and compile time printed after init, for --profile and bench runs */
+    bool _cache_stats = false;
+
+    /* every pipeline compiles on these threads, all built once init returns */
+    pipeline_queue _compiles;
+
     upload_context _upload_context;
     void immediate_submit(std::function<void(VkCommandBuffer cmd)> &&fs);
 
@@ -103,6 +287,16 @@ public:
     void draw();
     void run();
 
+    bool read_target(std::vector<unsigned char> &pixels);
+    bool read_img(std::string name, uint32_t texel_size, std::vector<char> &texels);
+
+    /*
+        draw_nodes skips the meshes from now on, their arena ranges are reused
+        once the frames in flight are done. upload_draws writes the indirect
+        draws once, so only the per-mesh path unloads.
+    */
+    void unload_meshes(mesh *meshes, size_t size);
+
 private:
     VmaVulkanFunctions vma_vulkan_func;
 
@@ -111,6 +305,11 @@ private:
     void swapchain_init();
     void command_init();
     void sync_init();
+    void profiler_init();
+    void uniform_init();
+    void upload_init();
+    void pipeline_cache_init();
+    void pipeline_cache_write();
 
     void descriptor_init();
     
@@ -120,18 +319,31 @@ private:
     void pipeline_init();
 
     void imgui_init();
+    void new_frame();
 
     void load_meshes();
     void upload_meshes(mesh *meshes, size_t size);
     void upload_textures(mesh *meshes, size_t size);
+    void arena_init();
+    void free_retired();
+    void upload_draws();
 
     void comp_init();
     void cloudtex_init();
     void weather_init();
+    void light_init();
     void cloud_init();
+    void temporal_init();
+    void upsample_init();
+    void cull_init();
+    void occlusion_init();
 
     void draw_comp(frame *frame);
+    void draw_occlusion(frame *frame);
+    void submit_comp(frame *frame);
+    void submit_gfx(frame *frame);
     void draw_nodes(frame *frame);
+    void draw_indirect(frame *frame, VkBuffer commands, VkBuffer count);
 
     frame *get_current_frame()
     {
@@ -142,9 +354,18 @@ private:
     void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
                        VmaAllocationCreateFlags flags, allocated_buffer *buffer);
 
+    /* device local buffer filled with data through a staging copy */
+    void upload_buffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage,
+                       allocated_buffer *buffer);
+
     void create_img(VkFormat format, VkExtent3D extent, VkImageAspectFlags aspect,
                     VkImageUsageFlags usage, VmaAllocationCreateFlags flags,
                     allocated_img *img);
 
     size_t pad_uniform_buffer_size(size_t original_size);
+
+    void release(VkCommandBuffer cbuffer, ownership_transfer transfer);
+    void release_outputs(VkCommandBuffer cbuffer, cs *cs);
+    void acquire(VkCommandBuffer cbuffer);
+    void build_mips(VkCommandBuffer cbuffer);
 };
@@ -4,7 +4,13 @@
 #include <SDL3/SDL_vulkan.h>
 #include <VkBootstrap.h>
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
 #include "vk_boiler.h"
+#include "vk_cache.h"
+#include "vk_pipeline.h"
 #include "vk_type.h"
 
 void vk_engine::device_init()
@@ -13,6 +19,7 @@ void vk_engine::device_init()
     vkb::InstanceBuilder builder;
     auto inst_ret = builder.set_app_name("vk_engine")
                         .require_api_version(VKB_VK_API_VERSION_1_3)
+                        .set_headless(_headless)
 #ifndef NDEBUG
                         .request_validation_layers(true)
                         .use_default_debug_messenger()
@@ -35,10 +42,12 @@ void vk_engine::device_init()
     });
 
     // create surface
-    SDL_Vulkan_CreateSurface(_window, _instance, nullptr, &_surface);
+    if (!_headless) {
+        SDL_Vulkan_CreateSurface(_window, _instance, nullptr, &_surface);
 
-    deletion_queue.push_back(
-        [=]() { vkDestroySurfaceKHR(_instance, _surface, nullptr); });
+        deletion_queue.push_back(
+            [=]() { vkDestroySurfaceKHR(_instance, _surface, nullptr); });
+    }
 
     VkPhysicalDeviceDynamicRenderingFeatures features = {};
     features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
@@ -47,8 +56,43 @@ void vk_engine::device_init()
 
     // create physical device
     vkb::PhysicalDeviceSelector selector(instance);
-    auto phys_ret =
-        selector.add_required_extension_features(features).set_surface(_surface).select();
+    selector.add_required_extension_features(features).require_present(!_headless);
+
+    /* the upload batches signal a timeline value when their copies are done */
+    VkPhysicalDeviceVulkan12Features features_12 = {};
+    features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features_12.pNext = nullptr;
+    features_12.timelineSemaphore = VK_TRUE;
+
+    /* a runtime sized texture array, written while earlier frames still use it */
+    if (_bindless) {
+        features_12.descriptorIndexing = VK_TRUE;
+        features_12.runtimeDescriptorArray = VK_TRUE;
+        features_12.descriptorBindingPartiallyBound = VK_TRUE;
+        features_12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+        features_12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    }
+
+    /*
+        many draws per call, each with its draw index in firstInstance, a
+        dynamically non-uniform texture index, a gpu count
+    */
+    VkPhysicalDeviceFeatures features_10 = {};
+    features_10.multiDrawIndirect = VK_TRUE;
+    features_10.drawIndirectFirstInstance = VK_TRUE;
+
+    if (_indirect) {
+        features_12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        features_12.drawIndirectCount = _cull;
+        selector.set_required_features(features_10);
+    }
+
+    selector.set_required_features_12(features_12);
+
+    if (!_headless)
+        selector.set_surface(_surface);
+
+    auto phys_ret = selector.select();
 
     if (!phys_ret) {
         std::cerr << "failed to find suitable physical device: "
@@ -61,6 +105,20 @@ void vk_engine::device_init()
     _min_buffer_alignment =
         physical_device.properties.limits.minUniformBufferOffsetAlignment;
 
+    if (_bindless) {
+        VkPhysicalDeviceVulkan12Properties properties_12 = {};
+        properties_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &properties_12;
+        vkGetPhysicalDeviceProperties2(_physical_device, &properties);
+
+        _max_textures = std::min(
+            {_max_textures, properties_12.maxDescriptorSetUpdateAfterBindSampledImages,
+             properties_12.maxPerStageDescriptorUpdateAfterBindSamplers});
+    }
+
     // create device
     vkb::DeviceBuilder device_builder(physical_device);
     auto dev_ret = device_builder.build();
@@ -82,20 +140,33 @@ void vk_engine::device_init()
         abort();
     }
     _gfx_queue = queue_ret.value();
-
-    queue_ret = device.get_queue(vkb::QueueType::graphics);
-    if (!queue_ret) {
-        std::cerr << "failed to get transfer queue:" << queue_ret.error() << std::endl;
-        abort();
+    _gfx_index = device.get_queue_index(vkb::QueueType::graphics).value();
+
+    /*
+        vk-bootstrap creates one queue per family, compute and transfer take a
+        family without graphics when the device has one, the graphics queue
+        otherwise. they may end up sharing one family with each other.
+        _single_queue keeps both on the graphics queue.
+    */
+    queue_ret = device.get_queue(vkb::QueueType::transfer);
+    if (queue_ret && !_single_queue) {
+        _transfer_queue = queue_ret.value();
+        _transfer_index = device.get_queue_index(vkb::QueueType::transfer).value();
+    } else {
+        _transfer_queue = _gfx_queue;
+        _transfer_index = _gfx_index;
     }
-    _transfer_queue = queue_ret.value();
 
-    queue_ret = device.get_queue(vkb::QueueType::graphics);
-    if (!queue_ret) {
-        std::cerr << "failed to get compute queue:" << queue_ret.error() << std::endl;
-        abort();
+    queue_ret = device.get_queue(vkb::QueueType::compute);
+    if (queue_ret && !_single_queue) {
+        _comp_queue = queue_ret.value();
+        _comp_index = device.get_queue_index(vkb::QueueType::compute).value();
+    } else {
+        _comp_queue = _gfx_queue;
+        _comp_index = _gfx_index;
     }
-    _comp_queue = queue_ret.value();
+
+    _async_comp = _comp_index != _gfx_index;
 }
 
 void vk_engine::vma_init()
@@ -112,32 +183,36 @@ void vk_engine::vma_init()
 
 void vk_engine::swapchain_init()
 {
-    vkb::SwapchainBuilder vkb_swapchain_builder{_physical_device, _device, _surface};
-    vkb::Swapchain vkb_swapchain =
-        vkb_swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
-            .set_desired_extent(_window_extent.width, _window_extent.height)
-            .set_desired_format(VkSurfaceFormatKHR{_format, _colorspace})
-            .set_image_usage_flags(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-            .build()
-            .value();
-
-    _swapchain = vkb_swapchain.swapchain;
-    _swapchain_format = vkb_swapchain.image_format;
-    _swapchain_imgs = vkb_swapchain.get_images().value();
-    _swapchain_img_views = vkb_swapchain.get_image_views().value();
+    /* headless has nothing to present to, everything ends in _target */
+    if (!_headless) {
+        vkb::SwapchainBuilder vkb_swapchain_builder{_physical_device, _device, _surface};
+        vkb::Swapchain vkb_swapchain =
+            vkb_swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
+                .set_desired_extent(_window_extent.width, _window_extent.height)
+                .set_desired_format(VkSurfaceFormatKHR{_format, _colorspace})
+                .set_image_usage_flags(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+                .build()
+                .value();
+
+        _swapchain = vkb_swapchain.swapchain;
+        _swapchain_format = vkb_swapchain.image_format;
+        _swapchain_imgs = vkb_swapchain.get_images().value();
+        _swapchain_img_views = vkb_swapchain.get_image_views().value();
 
-    deletion_queue.push_back(
-        [=]() { vkDestroySwapchainKHR(_device, _swapchain, nullptr); });
-
-    for (uint32_t i = 0; i < _swapchain_img_views.size(); i++)
         deletion_queue.push_back(
-            [=]() { vkDestroyImageView(_device, _swapchain_img_views[i], nullptr); });
+            [=]() { vkDestroySwapchainKHR(_device, _swapchain, nullptr); });
+
+        for (uint32_t i = 0; i < _swapchain_img_views.size(); i++)
+            deletion_queue.push_back([=]() {
+                vkDestroyImageView(_device, _swapchain_img_views[i], nullptr);
+            });
+    }
 
     _depth_img.format = VK_FORMAT_D32_SFLOAT;
 
     VkImageCreateInfo img_info = vk_boiler::img_create_info(
         _depth_img.format, VkExtent3D{_resolution.width, _resolution.height, 1},
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 
     VmaAllocationCreateInfo alloc_info = {};
     alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
@@ -168,6 +243,15 @@ void vk_engine::swapchain_init()
                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0,
                 &_target);
 
+    /* one host visible copy of _target per frame in flight */
+    if (_headless && _readback) {
+        for (uint32_t i = 0; i < FRAME_OVERLAP; ++i)
+            create_buffer(_resolution.width * _resolution.height * 4,
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
+                          &_frames[i].readback);
+    }
+
     VkSamplerCreateInfo sampler_info = vk_boiler::sampler_create_info();
     VK_CHECK(vkCreateSampler(_device, &sampler_info, nullptr, &_sampler));
     deletion_queue.push_back([=]() { vkDestroySampler(_device, _sampler, nullptr); });
@@ -188,6 +272,20 @@ void vk_engine::command_init()
 
         VK_CHECK(vkAllocateCommandBuffers(_device, &cbuffer_allocate_info,
                                           &_frames[i].cbuffer));
+
+        cpool_info = vk_boiler::cpool_create_info(_comp_index);
+
+        VK_CHECK(
+            vkCreateCommandPool(_device, &cpool_info, nullptr, &_frames[i].comp_cpool));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroyCommandPool(_device, _frames[i].comp_cpool, nullptr); });
+
+        cbuffer_allocate_info =
+            vk_boiler::cbuffer_allocate_info(1, _frames[i].comp_cpool);
+
+        VK_CHECK(vkAllocateCommandBuffers(_device, &cbuffer_allocate_info,
+                                          &_frames[i].comp_cbuffer));
     }
 
     VkCommandPoolCreateInfo cpool_info = vk_boiler::cpool_create_info(_transfer_index);
@@ -204,6 +302,103 @@ void vk_engine::command_init()
                                       &_upload_context.cbuffer));
 }
 
+void vk_engine::profiler_init()
+{
+    _profiler.init(_device, _physical_device, _gfx_index, _comp_index, FRAME_OVERLAP);
+
+    if (_profile_path)
+        _profiler.open(_profile_path);
+}
+
+void vk_engine::uniform_init()
+{
+    _uniforms.init(_allocator, _uniform_ring_size, FRAME_OVERLAP, _min_buffer_alignment);
+
+    deletion_queue.push_back([=]() { _uniforms.destroy(); });
+}
+
+void vk_engine::upload_init()
+{
+    _uploads.init(_device, _allocator, _transfer_queue, _transfer_index, _staging_size);
+
+    deletion_queue.push_back([=]() { _uploads.destroy(); });
+}
+
+/* a driver update or another gpu makes the old data useless */
+static uint64_t pipeline_cache_key(const VkPhysicalDeviceProperties &properties)
+{
+    uint64_t key = vk_cache::fnv1a(&properties.vendorID, sizeof(uint32_t));
+    key = vk_cache::fnv1a(&properties.deviceID, sizeof(uint32_t), key);
+    key = vk_cache::fnv1a(&properties.driverVersion, sizeof(uint32_t), key);
+    return vk_cache::fnv1a(properties.pipelineCacheUUID, VK_UUID_SIZE, key);
+}
+
+/* the header vulkan puts in front of the data, checked before the driver sees it */
+static bool pipeline_cache_valid(const std::vector<char> &data,
+                                 const VkPhysicalDeviceProperties &properties)
+{
+    VkPipelineCacheHeaderVersionOne header;
+
+    if (data.size() < sizeof(header))
+        return false;
+
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           !std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                        VK_UUID_SIZE);
+}
+
+void vk_engine::pipeline_cache_init()
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(_physical_device, &properties);
+
+    std::vector<char> data;
+    if (_pipeline_cache_path &&
+        vk_cache::read(_pipeline_cache_path, pipeline_cache_key(properties), data) &&
+        !pipeline_cache_valid(data, properties)) {
+        std::cerr << "pipeline cache: " << _pipeline_cache_path
+                  << " is from another device, ignored" << std::endl;
+        data.clear();
+    }
+
+    VkPipelineCacheCreateInfo pipeline_cache_info = {};
+    pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipeline_cache_info.pNext = nullptr;
+    pipeline_cache_info.initialDataSize = data.size();
+    pipeline_cache_info.pInitialData = data.empty() ? nullptr : data.data();
+
+    VK_CHECK(
+        vkCreatePipelineCache(_device, &pipeline_cache_info, nullptr, &_pipeline_cache));
+
+    deletion_queue.push_back(
+        [=]() { vkDestroyPipelineCache(_device, _pipeline_cache, nullptr); });
+
+    PipelineBuilder::_pipeline_cache = _pipeline_cache;
+}
+
+void vk_engine::pipeline_cache_write()
+{
+    if (!_pipeline_cache_path)
+        return;
+
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(_device, _pipeline_cache, &size, nullptr));
+
+    std::vector<char> data(size);
+    VK_CHECK(vkGetPipelineCacheData(_device, _pipeline_cache, &size, data.data()));
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(_physical_device, &properties);
+
+    vk_cache::write(_pipeline_cache_path, pipeline_cache_key(properties), data.data(),
+                    size);
+}
+
 void vk_engine::sync_init()
 {
     for (uint32_t i = 0; i < FRAME_OVERLAP; ++i) {
@@ -225,6 +420,18 @@ void vk_engine::sync_init()
 
         deletion_queue.push_back(
             [=]() { vkDestroySemaphore(_device, _frames[i].present_sem, nullptr); });
+
+        VK_CHECK(vkCreateSemaphore(_device, &sem_info, nullptr, &_frames[i].comp_sem));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroySemaphore(_device, _frames[i].comp_sem, nullptr); });
+
+        VK_CHECK(vkCreateSemaphore(_device, &sem_info, nullptr, &_frames[i].gfx_sem));
+
+        deletion_queue.push_back(
+            [=]() { vkDestroySemaphore(_device, _frames[i].gfx_sem, nullptr); });
+
+        _frames[i].comp_submitted = false;
     }
 
     VkFenceCreateInfo fence_info = vk_boiler::fence_create_info(false);
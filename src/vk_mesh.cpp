@@ -1,8 +1,11 @@
 #include "vk_mesh.h"
 
+#include <algorithm>
 #include <vector>
 
 #define GLM_ENABLE_EXPERIMENTAL
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/mat4x4.hpp>
@@ -38,7 +41,7 @@ buffer_view retreive_buffer(Model *model, Primitive *primitive,
 
 texture_view retreive_texture(Model *model, uint32_t material_index = -1);
 
-std::vector<mesh> load_from_gltf(const char *filename, std::vector<node> &nodes);
+std::vector<mesh> load_from_gltf(const char *filename, scene_graph &graph);
 
 vertex_input_description vertex::get_vertex_input_description()
 {
@@ -166,7 +169,91 @@ texture_view retreive_texture(Model *model, uint32_t material_index)
     return texture_view;
 }
 
-std::vector<mesh> load_from_gltf(const char *filename, std::vector<node> &nodes)
+static glm::mat4 local_matrix(const Node *n)
+{
+    glm::mat4 t = glm::translate(glm::mat4(1.f), glm::vec3(0.f));
+    glm::mat4 r = glm::translate(glm::mat4(1.f), glm::vec3(0.f));
+    glm::mat4 s = glm::scale(t, glm::vec3(1.f));
+
+    if (n->translation.size() != 0)
+        t = glm::translate(
+            glm::mat4(1.f),
+            glm::vec3(n->translation[0], n->translation[1], n->translation[2]));
+
+    if (n->rotation.size() != 0)
+        r = glm::toMat4(
+            glm::quat(n->rotation[3], n->rotation[0], n->rotation[1], n->rotation[2]));
+
+    if (n->scale.size() != 0)
+        s = glm::scale(glm::mat4(1.f), glm::vec3(n->scale[0], n->scale[1], n->scale[2]));
+
+    if (n->matrix.size() != 0)
+        return glm::mat4(n->matrix[0], n->matrix[1], n->matrix[2], n->matrix[3],
+                         n->matrix[4], n->matrix[5], n->matrix[6], n->matrix[7],
+                         n->matrix[8], n->matrix[9], n->matrix[10], n->matrix[11],
+                         n->matrix[12], n->matrix[13], n->matrix[14], n->matrix[15]);
+
+    return s * r * t;
+}
+
+/* depth first, so parents land before their children and subtrees stay packed */
+static void flatten(Model *model, uint32_t index, uint32_t parent, scene_graph &graph)
+{
+    const Node *n = &model->nodes[index];
+
+    uint32_t mesh_id = n->mesh == -1 ? NO_MESH : mesh_base + n->mesh;
+    uint32_t i = graph.push(n->name, parent, mesh_id, local_matrix(n));
+
+    for (int c : n->children)
+        flatten(model, c, i, graph);
+
+    graph.ends[i] = graph.size();
+}
+
+uint32_t scene_graph::push(std::string name, uint32_t parent, uint32_t mesh_id,
+                           const glm::mat4 &local)
+{
+    uint32_t i = size();
+
+    worlds.push_back(local);
+    mesh_ids.push_back(mesh_id);
+    locals.push_back(local);
+    parents.push_back(parent);
+    ends.push_back(i + 1);
+    dirty.push_back(1);
+    names.push_back(name);
+
+    return i;
+}
+
+void scene_graph::set_local(uint32_t i, const glm::mat4 &local)
+{
+    locals[i] = local;
+    dirty[i] = 1;
+}
+
+void scene_graph::update()
+{
+    uint32_t i = 0;
+
+    while (i < size()) {
+        if (!dirty[i]) {
+            ++i;
+            continue;
+        }
+
+        /* the whole subtree in order, every parent is done before its children */
+        for (uint32_t j = i; j < ends[i]; ++j) {
+            uint32_t p = parents[j];
+            worlds[j] = p == NO_NODE ? locals[j] : worlds[p] * locals[j];
+            dirty[j] = 0;
+        }
+
+        i = ends[i];
+    }
+}
+
+std::vector<mesh> load_from_gltf(const char *filename, scene_graph &graph)
 {
     TinyGLTF loader;
     Model model;
@@ -188,41 +275,15 @@ std::vector<mesh> load_from_gltf(const char *filename, std::vector<node> &nodes)
         return meshes;
     }
 
-    for (auto n = model.nodes.cbegin(); n != model.nodes.cend(); ++n) {
-        node node;
-        node.name = n->name;
-        node.mesh_id = mesh_base + n->mesh;
-        node.children = n->children;
-
-        glm::mat4 t = glm::translate(glm::mat4(1.f), glm::vec3(0.f));
-        glm::mat4 r = glm::translate(glm::mat4(1.f), glm::vec3(0.f));
-        glm::mat4 s = glm::scale(t, glm::vec3(1.f));
-
-        if (n->translation.size() != 0)
-            t = glm::translate(
-                glm::mat4(1.f),
-                glm::vec3(n->translation[0], n->translation[1], n->translation[2]));
-
-        if (n->rotation.size() != 0)
-            r = glm::toMat4(glm::quat(n->rotation[3], n->rotation[0], n->rotation[1],
-                                      n->rotation[2]));
-
-        if (n->scale.size() != 0)
-            s = glm::scale(glm::mat4(1.f),
-                           glm::vec3(n->scale[0], n->scale[1], n->scale[2]));
-
-        node.transform_mat = s * r * t;
-
-        if (n->matrix.size() != 0) {
-            node.transform_mat =
-                glm::mat4(n->matrix[0], n->matrix[1], n->matrix[2], n->matrix[3],
-                          n->matrix[4], n->matrix[5], n->matrix[6], n->matrix[7],
-                          n->matrix[8], n->matrix[9], n->matrix[10], n->matrix[11],
-                          n->matrix[12], n->matrix[13], n->matrix[14], n->matrix[15]);
-        }
+    /* roots are the nodes no other node lists as a child */
+    std::vector<bool> child(model.nodes.size(), false);
+    for (const Node &n : model.nodes)
+        for (int c : n.children)
+            child[c] = true;
 
-        nodes.push_back(node);
-    }
+    for (uint32_t i = 0; i < model.nodes.size(); ++i)
+        if (!child[i])
+            flatten(&model, i, NO_NODE, graph);
 
     for (auto m = model.meshes.cbegin(); m != model.meshes.cend(); ++m) {
         mesh mesh;
@@ -239,6 +300,22 @@ std::vector<mesh> load_from_gltf(const char *filename, std::vector<node> &nodes)
             data += pos.stride;
         }
 
+        /* BOUNDS, the sphere is centered on the box, not minimal but close */
+        if (pos.count) {
+            mesh.aabb_min = mesh.aabb_max = mesh.vertices[0].pos;
+            for (const vertex &v : mesh.vertices) {
+                mesh.aabb_min = glm::min(mesh.aabb_min, v.pos);
+                mesh.aabb_max = glm::max(mesh.aabb_max, v.pos);
+            }
+
+            glm::vec3 center = (mesh.aabb_min + mesh.aabb_max) * .5f;
+            float radius = 0.f;
+            for (const vertex &v : mesh.vertices)
+                radius = glm::max(radius, glm::distance(center, v.pos));
+
+            mesh.sphere = glm::vec4(center, radius);
+        }
+
         /* NORMAL */
         buffer_view normal = retreive_buffer(&model, &primitive, -1, "NORMAL");
         data = normal.data;
@@ -288,17 +365,13 @@ std::vector<mesh> load_from_gltf(const char *filename, std::vector<node> &nodes)
 
 void vk_engine::load_meshes()
 {
-    std::vector<mesh> example = load_from_gltf(
-        "./assets/glTF-Sample-Assets/Models/Duck/glTF-Binary/Duck.glb", _nodes);
+    std::vector<mesh> example = load_from_gltf(_scene, _graph);
 
     _meshes.insert(_meshes.end(), example.begin(), example.end());
 
-    create_buffer(_nodes.size() * pad_uniform_buffer_size(sizeof(render_mat)),
-                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                  VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, &_render_mat_buffer);
-
+    /* every node's matrices go through the uniform ring */
     VkDescriptorBufferInfo descriptor_buffer_info = {};
-    descriptor_buffer_info.buffer = _render_mat_buffer.buffer;
+    descriptor_buffer_info.buffer = _uniforms.view(sizeof(render_mat)).buffer;
     descriptor_buffer_info.offset = 0;
     descriptor_buffer_info.range = sizeof(render_mat);
 
@@ -309,81 +382,84 @@ void vk_engine::load_meshes()
     vkUpdateDescriptorSets(_device, 1, &write_set, 0, nullptr);
 }
 
+void vk_engine::arena_init()
+{
+    uint32_t vertices = 0;
+    uint32_t indices = 0;
+    for (const mesh &mesh : _meshes) {
+        vertices += mesh.vertices.size();
+        indices += mesh.indices.size();
+    }
+
+    /* the indirect draw binds one block, the first fits everything loaded now */
+    _arena.init(_allocator, sizeof(vertex), sizeof(uint16_t),
+                std::max(_arena_vertices, vertices), std::max(_arena_indices, indices),
+                {_gfx_index, _transfer_index});
+
+    deletion_queue.push_back([=]() { _arena.destroy(); });
+}
+
 void vk_engine::upload_meshes(mesh *meshes, size_t size)
 {
+    /* recorded into the open batch, the arena is shared and needs no release */
     for (uint32_t i = 0; i < size; ++i) {
         mesh *mesh = &meshes[i];
-        allocated_buffer staging_buffer;
+        mesh->range = _arena.allocate(mesh->vertices.size(), mesh->indices.size());
+
+        _uploads.copy_buffer(mesh->vertices.data(),
+                             mesh->vertices.size() * sizeof(vertex),
+                             _arena.vertex_buffer(mesh->range.block),
+                             (VkDeviceSize)mesh->range.first_vertex * sizeof(vertex));
+        _uploads.copy_buffer(mesh->indices.data(),
+                             mesh->indices.size() * sizeof(uint16_t),
+                             _arena.index_buffer(mesh->range.block),
+                             (VkDeviceSize)mesh->range.first_index * sizeof(uint16_t));
+    }
+}
 
-        /* create vertex buffer */
-        create_buffer(mesh->vertices.size() * sizeof(vertex),
-                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, &staging_buffer);
+void vk_engine::unload_meshes(mesh *meshes, size_t size)
+{
+    if (_indirect) {
+        std::cerr << "arena: the indirect draws still reference the meshes" << std::endl;
+        return;
+    }
 
-        void *data;
-        vmaMapMemory(_allocator, staging_buffer.allocation, &data);
-        std::memcpy(data, mesh->vertices.data(), mesh->vertices.size() * sizeof(vertex));
-        vmaUnmapMemory(_allocator, staging_buffer.allocation);
+    /* frames up to _frame_number may have recorded a draw of them */
+    for (uint32_t i = 0; i < size; ++i) {
+        if (meshes[i].range.block != NO_BLOCK)
+            _retired_ranges.push_back(retired_range{meshes[i].range, _frame_number});
 
-        create_buffer(mesh->vertices.size() * sizeof(vertex),
-                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                      0, &mesh->vertex_buffer);
-
-        deletion_queue.push_back([=]() {
-            vmaDestroyBuffer(_allocator, _meshes[i].vertex_buffer.buffer,
-                             _meshes[i].vertex_buffer.allocation);
-        });
-
-        immediate_submit([=](VkCommandBuffer cbuffer) {
-            VkBufferCopy region = {};
-            region.size = mesh->vertices.size() * sizeof(vertex);
-            vkCmdCopyBuffer(cbuffer, staging_buffer.buffer, mesh->vertex_buffer.buffer, 1,
-                            &region);
-        });
-
-        vmaDestroyBuffer(_allocator, staging_buffer.buffer, staging_buffer.allocation);
-
-        /* create index buffer */
-        create_buffer(mesh->indices.size() * sizeof(uint16_t),
-                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, &staging_buffer);
-
-        vmaMapMemory(_allocator, staging_buffer.allocation, &data);
-        std::memcpy(data, mesh->indices.data(), mesh->indices.size() * sizeof(uint16_t));
-        vmaUnmapMemory(_allocator, staging_buffer.allocation);
-
-        create_buffer(mesh->indices.size() * sizeof(uint16_t),
-                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                      0, &mesh->index_buffer);
-
-        immediate_submit([=](VkCommandBuffer cbuffer) {
-            VkBufferCopy region = {};
-            region.size = mesh->indices.size() * sizeof(uint16_t);
-            vkCmdCopyBuffer(cbuffer, staging_buffer.buffer, mesh->index_buffer.buffer, 1,
-                            &region);
-        });
-
-        vmaDestroyBuffer(_allocator, staging_buffer.buffer, staging_buffer.allocation);
+        meshes[i].range = {};
     }
 }
 
+void vk_engine::free_retired()
+{
+    /* the fence just waited on is the one of _frame_number - FRAME_OVERLAP */
+    auto done = [&](const retired_range &retired) {
+        if (retired.frame + FRAME_OVERLAP > _frame_number)
+            return false;
+
+        _arena.free(retired.range);
+        return true;
+    };
+
+    _retired_ranges.erase(
+        std::remove_if(_retired_ranges.begin(), _retired_ranges.end(), done),
+        _retired_ranges.end());
+}
+
 void vk_engine::upload_textures(mesh *meshes, size_t size)
 {
     for (uint32_t i = 0; i < size; ++i) {
         mesh *mesh = &meshes[i];
-        allocated_buffer staging_buffer;
-
         if (mesh->texture.size() != 0) {
-            create_buffer(mesh->texture.size() * sizeof(unsigned char),
-                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                          VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, &staging_buffer);
-
-            void *data;
-            vmaMapMemory(_allocator, staging_buffer.allocation, &data);
-            std::memcpy(data, mesh->texture.data(),
-                        mesh->texture.size() * sizeof(unsigned char));
-            vmaUnmapMemory(_allocator, staging_buffer.allocation);
+            /* past the array the mesh draws untextured, nothing is created for it */
+            if (_bindless && _texture_count == _max_textures) {
+                std::cerr << "bindless: more than " << _max_textures << " textures"
+                          << std::endl;
+                continue;
+            }
 
             VkExtent3D extent = {};
             extent.width = mesh->texture_buffer.extent.width;
@@ -394,25 +470,39 @@ void vk_engine::upload_textures(mesh *meshes, size_t size)
                        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, 0,
                        &mesh->texture_buffer);
 
-            immediate_submit([=](VkCommandBuffer cbuffer) {
-                vk_cmd::vk_img_layout_transition(
-                    cbuffer, mesh->texture_buffer.img, VK_IMAGE_LAYOUT_UNDEFINED,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, _transfer_index);
+            vk_cmd::vk_img_layout_transition(
+                _uploads.cbuffer(), mesh->texture_buffer.img, VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, _transfer_index);
 
-                VkBufferImageCopy region = vk_boiler::buffer_img_copy(extent);
+            _uploads.copy_img(mesh->texture.data(),
+                              mesh->texture.size() * sizeof(unsigned char),
+                              mesh->texture_buffer.img, extent);
 
-                vkCmdCopyBufferToImage(cbuffer, staging_buffer.buffer,
-                                       mesh->texture_buffer.img,
-                                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            /* the transition happens as part of handing it to graphics */
+            ownership_transfer transfer = {};
+            transfer.img = mesh->texture_buffer.img;
+            transfer.old_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            transfer.new_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            transfer.src_index = _transfer_index;
+            release(_uploads.cbuffer(), transfer);
 
-                vk_cmd::vk_img_layout_transition(cbuffer, mesh->texture_buffer.img,
-                                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                                                 _transfer_index);
-            });
+            VkDescriptorImageInfo descriptor_img_info = {};
+            descriptor_img_info.sampler = _sampler;
+            descriptor_img_info.imageView = mesh->texture_buffer.img_view;
+            descriptor_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+            /* next free element of the array, no set of its own */
+            if (_bindless) {
+                mesh->texture_id = _texture_count++;
 
-            vmaDestroyBuffer(_allocator, staging_buffer.buffer,
-                             staging_buffer.allocation);
+                VkWriteDescriptorSet write_set = vk_boiler::write_descriptor_set(
+                    &descriptor_img_info, _bindless_set, 0,
+                    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+                write_set.dstArrayElement = mesh->texture_id;
+
+                vkUpdateDescriptorSets(_device, 1, &write_set, 0, nullptr);
+                continue;
+            }
 
             VkDescriptorSetAllocateInfo descriptor_set_allocate_info =
                 vk_boiler::descriptor_set_allocate_info(_descriptor_pool,
@@ -421,11 +511,6 @@ void vk_engine::upload_textures(mesh *meshes, size_t size)
             VK_CHECK(vkAllocateDescriptorSets(_device, &descriptor_set_allocate_info,
                                               &mesh->texture_set));
 
-            VkDescriptorImageInfo descriptor_img_info = {};
-            descriptor_img_info.sampler = _sampler;
-            descriptor_img_info.imageView = mesh->texture_buffer.img_view;
-            descriptor_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
             VkWriteDescriptorSet write_set = vk_boiler::write_descriptor_set(
                 &descriptor_img_info, mesh->texture_set, 0,
                 VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
@@ -434,3 +519,94 @@ void vk_engine::upload_textures(mesh *meshes, size_t size)
         }
     }
 }
+
+void vk_engine::upload_draws()
+{
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    std::vector<draw_data> draws;
+    std::vector<draw_bounds> bounds;
+
+    /* nothing moves yet, the draws are written once */
+    _graph.update();
+
+    for (uint32_t i = 0; i < _graph.size(); ++i) {
+        if (_graph.mesh_ids[i] == NO_MESH)
+            continue;
+
+        mesh *mesh = &_meshes[_graph.mesh_ids[i]];
+
+        VkDrawIndexedIndirectCommand command = {};
+        command.indexCount = mesh->range.index_count;
+        command.instanceCount = 1;
+        command.firstIndex = mesh->range.first_index;
+        command.vertexOffset = mesh->range.first_vertex;
+        /* the draw's index, it outlives the reordering culling does */
+        command.firstInstance = draws.size();
+        commands.push_back(command);
+
+        draw_data draw = {};
+        draw.model = _graph.worlds[i];
+        draw.texture_id = mesh->texture_id;
+        draws.push_back(draw);
+
+        draw_bounds bound = {};
+        bound.sphere = mesh->sphere;
+        bound.aabb_min = glm::vec4(mesh->aabb_min, 0.f);
+        bound.aabb_max = glm::vec4(mesh->aabb_max, 0.f);
+        bounds.push_back(bound);
+    }
+
+    _draw_count = commands.size();
+    if (_draw_count == 0)
+        return;
+
+    /* with culling, every command is input to cull.comp and only the visible drawn */
+    upload_buffer(commands.data(), commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+                  VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                  &_draw_commands);
+    upload_buffer(draws.data(), draws.size() * sizeof(draw_data),
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &_draw_data);
+
+    if (_cull) {
+        upload_buffer(bounds.data(), bounds.size() * sizeof(draw_bounds),
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &_draw_bounds);
+
+        create_buffer(commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      0, &_visible_commands);
+        create_buffer(sizeof(uint32_t),
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      0, &_visible_count);
+    }
+
+    if (_occlusion) {
+        create_buffer(commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      0, &_late_commands);
+        create_buffer(sizeof(uint32_t),
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      0, &_late_count);
+
+        /* nothing was visible before the first frame, its late phase draws it all */
+        std::vector<uint32_t> visibility(commands.size(), 0);
+        upload_buffer(visibility.data(), visibility.size() * sizeof(uint32_t),
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &_draw_visibility);
+    }
+
+    VkDescriptorBufferInfo descriptor_buffer_info = {};
+    descriptor_buffer_info.buffer = _draw_data.buffer;
+    descriptor_buffer_info.offset = 0;
+    descriptor_buffer_info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write_set = vk_boiler::write_descriptor_set(
+        &descriptor_buffer_info, _draw_set, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+    vkUpdateDescriptorSets(_device, 1, &write_set, 0, nullptr);
+}
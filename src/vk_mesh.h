@@ -5,10 +5,15 @@
 #include <volk.h>
 
 #include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 
+#include "vk_arena.h"
 #include "vk_type.h"
 
+constexpr uint32_t NO_TEXTURE = UINT32_MAX;
+
 struct vertex_input_description {
     std::vector<VkVertexInputBindingDescription> bindings;
     std::vector<VkVertexInputAttributeDescription> attributes;
@@ -24,14 +29,57 @@ struct vertex {
 
 struct mesh {
     std::vector<vertex> vertices;
-    allocated_buffer vertex_buffer;
-
     std::vector<uint16_t> indices;
-    allocated_buffer index_buffer;
+
+    /* vertices and indices on the gpu, see vk_engine::_arena */
+    arena_range range;
 
     std::vector<unsigned char> texture;
     allocated_img texture_buffer;
     VkDescriptorSet texture_set;
+
+    /* element of the bindless array, NO_TEXTURE without one */
+    uint32_t texture_id = NO_TEXTURE;
+
+    /* around the vertices in the mesh's own space, radius in sphere.w */
+    glm::vec3 aabb_min = glm::vec3(0.f);
+    glm::vec3 aabb_max = glm::vec3(0.f);
+    glm::vec4 sphere = glm::vec4(0.f);
+};
+
+/* per draw of the indirect path, std430 DRAWS in .vert */
+struct draw_data {
+    glm::mat4 model;
+    uint32_t texture_id;
+    uint32_t pad[3];
+};
+
+/* mesh bounds of a draw, std430 BOUNDS in cull.comp */
+struct draw_bounds {
+    glm::vec4 sphere;
+    glm::vec4 aabb_min;
+    glm::vec4 aabb_max;
+};
+
+/* push constants of cull.comp */
+struct cull_data {
+    glm::vec4 planes[6];
+    uint32_t draw_count;
+};
+
+/* push constants of cull.comp built with LATE */
+struct occlusion_data {
+    glm::mat4 view_proj;
+    glm::vec2 pyramid_size;
+    uint32_t draw_count;
+    uint32_t pyramid_levels;
+};
+
+/* push constants of pyramid.comp, first reads the depth attachment */
+struct pyramid_data {
+    glm::ivec2 src_size;
+    glm::ivec2 dst_size;
+    int first;
 };
 
 struct material {
@@ -39,12 +87,45 @@ struct material {
     VkPipelineLayout pipeline_layout;
 };
 
-struct node {
-    std::string name;
-    uint32_t mesh_id;
-    glm::mat4 transform_mat;
-    std::vector<int> children;
-    // material material;
+/*
+    Node hierarchy flattened depth first, one array per field. A parent comes
+    before its children and the subtree of node i is [i, ends[i]), so world
+    matrices are rebuilt in one pass over the subtrees marked dirty.
+
+        uint32_t i = graph.push(name, parent, mesh_id, local);
+        ... children of i ...
+        graph.ends[i] = graph.size();
+
+        graph.set_local(i, local);      // every frame it moves
+        graph.update();                 // before reading worlds
+*/
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+constexpr uint32_t NO_MESH = UINT32_MAX;
+
+struct scene_graph {
+public:
+    /* hot, read every frame */
+    std::vector<glm::mat4> worlds;
+    std::vector<uint32_t> mesh_ids;
+
+    /* touched when something moves */
+    std::vector<glm::mat4> locals;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> ends;
+    std::vector<uint8_t> dirty;
+
+    std::vector<std::string> names;
+
+    uint32_t push(std::string name, uint32_t parent, uint32_t mesh_id,
+                  const glm::mat4 &local);
+
+    void set_local(uint32_t i, const glm::mat4 &local);
+
+    /* recompute the world matrices below every dirty node */
+    void update();
+
+    inline uint32_t size() { return worlds.size(); };
 };
 
-std::vector<mesh> load_from_gltf(const char *filename, std::vector<node> &nodes);
\ No newline at end of file
+std::vector<mesh> load_from_gltf(const char *filename, scene_graph &graph);
\ No newline at end of file
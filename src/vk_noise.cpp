@@ -0,0 +1,408 @@
+#include "vk_noise.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "vk_simd.h"
+
+using namespace vk_simd;
+
+namespace
+{
+const int32_t p[512] = {
+    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,   225,
+    140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190, 6,   148,
+    247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203, 117, 35,  11,  32,
+    57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125, 136, 171, 168, 68,  175,
+    74,  165, 71,  134, 139, 48,  27,  166, 77,  146, 158, 231, 83,  111, 229, 122,
+    60,  211, 133, 230, 220, 105, 92,  41,  55,  46,  245, 40,  244, 102, 143, 54,
+    65,  25,  63,  161, 1,   216, 80,  73,  209, 76,  132, 187, 208, 89,  18,  169,
+    200, 196, 135, 130, 116, 188, 159, 86,  164, 100, 109, 198, 173, 186, 3,   64,
+    52,  217, 226, 250, 124, 123, 5,   202, 38,  147, 118, 126, 255, 82,  85,  212,
+    207, 206, 59,  227, 47,  16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213,
+    119, 248, 152, 2,   44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,
+    129, 22,  39,  253, 19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104,
+    218, 246, 97,  228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241,
+    81,  51,  145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157,
+    184, 84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205, 93,
+    222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156, 180,
+    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,   225,
+    140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190, 6,   148,
+    247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203, 117, 35,  11,  32,
+    57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125, 136, 171, 168, 68,  175,
+    74,  165, 71,  134, 139, 48,  27,  166, 77,  146, 158, 231, 83,  111, 229, 122,
+    60,  211, 133, 230, 220, 105, 92,  41,  55,  46,  245, 40,  244, 102, 143, 54,
+    65,  25,  63,  161, 1,   216, 80,  73,  209, 76,  132, 187, 208, 89,  18,  169,
+    200, 196, 135, 130, 116, 188, 159, 86,  164, 100, 109, 198, 173, 186, 3,   64,
+    52,  217, 226, 250, 124, 123, 5,   202, 38,  147, 118, 126, 255, 82,  85,  212,
+    207, 206, 59,  227, 47,  16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213,
+    119, 248, 152, 2,   44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,
+    129, 22,  39,  253, 19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104,
+    218, 246, 97,  228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241,
+    81,  51,  145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157,
+    184, 84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205, 93,
+    222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156, 180,
+};
+
+inline vf fade(vf t)
+{
+    return t * t * t * (t * (t * splat(6.f) - splat(15.f)) + splat(10.f));
+}
+
+inline vf lerp(vf a, vf b, vf t) { return a + t * (b - a); }
+
+inline vf remap(vf value, float old_min, float old_max, float new_min, float new_max)
+{
+    vf t = splat(new_min) + ((value - splat(old_min)) / splat(old_max - old_min)) *
+                                splat(new_max - new_min);
+    return vmin(vmax(t, splat(new_min)), splat(new_max));
+}
+
+/* bit 1, 2 and 4 of h negate x, y and z of (.707, .707, .707) */
+inline vf grad(vi h, vf x, vf y, vf z)
+{
+    vf s = splat(.707f);
+    return flip(bit(h, 1), x) * s + flip(bit(h, 2), y) * s + flip(bit(h, 4), z) * s;
+}
+
+/* bit 1 and 2 of h negate y and x of (.707, .707) */
+inline vf grad(vi h, vf x, vf y)
+{
+    vf s = splat(.707f);
+    return flip(bit(h, 2), x) * s + flip(bit(h, 1), y) * s;
+}
+
+vf perlin_noise(vf x, vf y, vf z, float f)
+{
+    vf fx = vfloor(x);
+    vf fy = vfloor(y);
+    vf fz = vfloor(z);
+
+    vi ix = to_int(fx) & splat(255);
+    vi iy = to_int(fy) & splat(255);
+    vi iz = to_int(fz) & splat(255);
+
+    x = x - fx;
+    y = y - fy;
+    z = z - fz;
+
+    vf u = fade(x);
+    vf v = fade(y);
+    vf w = fade(z);
+
+    vi ix1 = ix + splat(1);
+    vi iy1 = iy + splat(1);
+    vi iz1 = iz + splat(1);
+
+    ix1 = select(to_float(ix1) == splat(f), splat(0), ix1);
+    iy1 = select(to_float(iy1) == splat(f), splat(0), iy1);
+    iz1 = select(to_float(iz1) == splat(f), splat(0), iz1);
+
+    vi px = gather(p, ix);
+    vi px1 = gather(p, ix1);
+    vi pxy = gather(p, px + iy);
+    vi px1y = gather(p, px1 + iy);
+    vi pxy1 = gather(p, px + iy1);
+    vi px1y1 = gather(p, px1 + iy1);
+
+    vi a = gather(p, pxy + iz);
+    vi aa = gather(p, px1y + iz);
+    vi ab = gather(p, pxy1 + iz);
+    vi ac = gather(p, px1y1 + iz);
+    vi b = gather(p, pxy + iz1);
+    vi ba = gather(p, px1y + iz1);
+    vi bb = gather(p, pxy1 + iz1);
+    vi bc = gather(p, px1y1 + iz1);
+
+    vf x1 = x - splat(1.f);
+    vf y1 = y - splat(1.f);
+    vf z1 = z - splat(1.f);
+
+    vf alerp = lerp(lerp(grad(a, x, y, z), grad(aa, x1, y, z), u),
+                    lerp(grad(ab, x, y1, z), grad(ac, x1, y1, z), u), v);
+
+    vf blerp = lerp(lerp(grad(b, x, y, z1), grad(ba, x1, y, z1), u),
+                    lerp(grad(bb, x, y1, z1), grad(bc, x1, y1, z1), u), v);
+
+    return lerp(alerp, blerp, w);
+}
+
+/* ix % period for ix >= 0, through float the way there is no integer divide */
+inline vi mod(vi ix, uint32_t period)
+{
+    vi n = splat((int32_t)period);
+    vi r = ix - to_int(vfloor(to_float(ix) / to_float(n)) * to_float(n));
+    r = select(r < splat(0), r + n, r);
+    return select(r < n, r, r - n);
+}
+
+vf perlin_noise(vf x, vf y, uint32_t period)
+{
+    vf fx = vfloor(x);
+    vf fy = vfloor(y);
+
+    vi ix = to_int(fx);
+    vi iy = to_int(fy);
+    vi ix1 = ix + splat(1);
+    vi iy1 = iy + splat(1);
+
+    /* wrap the lattice, the noise then repeats every period cells */
+    if (period != 0) {
+        ix = mod(ix, period);
+        iy = mod(iy, period);
+        ix1 = mod(ix1, period) & splat(255);
+        iy1 = mod(iy1, period) & splat(255);
+    }
+
+    ix = ix & splat(255);
+    iy = iy & splat(255);
+
+    if (period == 0) {
+        ix1 = ix + splat(1);
+        iy1 = iy + splat(1);
+    }
+
+    x = x - fx;
+    y = y - fy;
+
+    vf u = fade(x);
+    vf v = fade(y);
+
+    vi px = gather(p, ix);
+    vi px1 = gather(p, ix1);
+
+    vi p_topleft = gather(p, px + iy);
+    vi p_topright = gather(p, px1 + iy);
+    vi p_bottomleft = gather(p, px + iy1);
+    vi p_bottomright = gather(p, px1 + iy1);
+
+    vf x1 = x - splat(1.f);
+    vf y1 = y - splat(1.f);
+
+    return lerp(lerp(grad(p_topleft, x, y), grad(p_topright, x1, y), u),
+                lerp(grad(p_bottomleft, x, y1), grad(p_bottomright, x1, y1), u), v);
+}
+
+void random3f(vf x, vf y, vf z, vf &rx, vf &ry, vf &rz)
+{
+    vf sx = x * splat(127.1f) + y * splat(311.7f) + z * splat(256.1f);
+    vf sy = x * splat(269.5f) + y * splat(183.3f) + z * splat(241.3f);
+    vf sz = x * splat(246.2f) + y * splat(225.6f) + z * splat(296.7f);
+
+    rx = fract(vsin(sx) * splat(43758.5453123f));
+    ry = fract(vsin(sy) * splat(43758.5453123f));
+    rz = fract(vsin(sz) * splat(43758.5453123f));
+}
+
+vf worley_noise(vf x, vf y, vf z, float f)
+{
+    vi ix = to_int(vfloor(x)) - splat(1);
+    vi iy = to_int(vfloor(y)) - splat(1);
+    vi iz = to_int(vfloor(z)) - splat(1);
+
+    /* position relative to the first of the 3x3x3 cells */
+    vf dx = x - to_float(ix);
+    vf dy = y - to_float(iy);
+    vf dz = z - to_float(iz);
+
+    vi last = splat((int32_t)std::floor(f) - 1);
+    vf t = splat(1.f);
+
+    for (int32_t i = 0; i < 3; ++i)
+        for (int32_t j = 0; j < 3; ++j)
+            for (int32_t k = 0; k < 3; ++k) {
+                vi ixi = ix + splat(i);
+                vi iyj = iy + splat(j);
+                vi izk = iz + splat(k);
+
+                ixi = select(to_float(ixi) == splat(f), splat(0), ixi);
+                iyj = select(to_float(iyj) == splat(f), splat(0), iyj);
+                izk = select(to_float(izk) == splat(f), splat(0), izk);
+
+                ixi = select(ixi < splat(0), last, ixi);
+                iyj = select(iyj < splat(0), last, iyj);
+                izk = select(izk < splat(0), last, izk);
+
+                vf rx, ry, rz;
+                random3f(to_float(ixi), to_float(iyj), to_float(izk), rx, ry, rz);
+
+                rx = rx + splat((float)i) - dx;
+                ry = ry + splat((float)j) - dy;
+                rz = rz + splat((float)k) - dz;
+
+                t = vmin(t, vsqrt(rz * rz + ry * ry + rx * rx));
+            }
+
+    return splat(1.f) - t;
+}
+
+/* h is 1, pow(f, -h) is 1 / f */
+vf fbm(vf x, vf y, vf z, uint32_t octaves, float infreq)
+{
+    vf t = splat(0.f);
+
+    for (uint32_t o = 0; o < octaves; ++o) {
+        float f = std::ldexp(infreq, o);
+        vf a = splat(1.f / f);
+        t = t + a * perlin_noise(splat(f) * x, splat(f) * y, splat(f) * z, f);
+    }
+
+    for (uint32_t o = 0; o < octaves; ++o) {
+        float f = std::ldexp(infreq, o);
+        vf a = splat(1.f / f);
+        vf worley = worley_noise(splat(f) * x, splat(f) * y, splat(f) * z, f);
+        t = t + a * (worley * splat(2.f) - splat(1.f));
+    }
+
+    return (t + splat(1.f)) * splat(.5f);
+}
+
+vf fbm_worley(vf x, vf y, vf z, uint32_t octaves, float infreq)
+{
+    vf t = splat(0.f);
+
+    for (uint32_t o = 0; o < octaves; ++o) {
+        float f = std::ldexp(infreq, o);
+        vf a = splat(1.f / f);
+        t = t + a * worley_noise(splat(f) * x, splat(f) * y, splat(f) * z, f);
+    }
+
+    return remap(t, 0.f, .6f, 0.f, 1.f);
+}
+
+vf fbm(vf x, vf y, uint32_t octaves, float h)
+{
+    vf t = splat(0.f);
+
+    for (uint32_t o = 0; o < octaves; ++o) {
+        float f = std::ldexp(1.f, o);
+        vf a = splat(std::pow(f, -h));
+        t = t + a * perlin_noise(splat(f) * x, splat(f) * y, 0);
+    }
+
+    return (t + splat(1.f)) * splat(.5f);
+}
+
+vf fbm_periodic(vf x, vf y, uint32_t octaves, float h, uint32_t period, float time)
+{
+    vf t = splat(0.f);
+
+    for (uint32_t o = 0; o < octaves; ++o) {
+        float f = std::ldexp(1.f, o);
+        vf a = splat(std::pow(f, -h));
+        uint32_t fp = period * (uint32_t)f;
+        float drift_x = time * std::cos(2.4f * o);
+        float drift_y = time * std::sin(2.4f * o);
+        vf qx = vmod(splat(f) * x + splat(drift_x), (float)fp);
+        vf qy = vmod(splat(f) * y + splat(drift_y), (float)fp);
+        t = t + a * perlin_noise(qx, qy, fp);
+    }
+
+    return (t + splat(1.f)) * splat(.5f);
+}
+
+/* as in weather.comp */
+const uint32_t weather_octaves = 16;
+const float weather_infreq = 8.f;
+const float weather_h = 1.f;
+const float weather_evolve = .02f;
+} // namespace
+
+const uint32_t vk_noise::lanes = W;
+
+float vk_noise::perlin_noise(float x, float y, float z, float f)
+{
+    return lane0(::perlin_noise(splat(x), splat(y), splat(z), f));
+}
+
+glm::vec3 vk_noise::random3f(glm::vec3 st)
+{
+    vf x, y, z;
+    ::random3f(splat(st.x), splat(st.y), splat(st.z), x, y, z);
+    return glm::vec3(lane0(x), lane0(y), lane0(z));
+}
+
+float vk_noise::worley_noise(float x, float y, float z, float f)
+{
+    return lane0(::worley_noise(splat(x), splat(y), splat(z), f));
+}
+
+float vk_noise::fbm(float x, float y, float z, uint32_t octaves, float infreq)
+{
+    return lane0(::fbm(splat(x), splat(y), splat(z), octaves, infreq));
+}
+
+float vk_noise::fbm_worley(float x, float y, float z, uint32_t octaves, float infreq)
+{
+    return lane0(::fbm_worley(splat(x), splat(y), splat(z), octaves, infreq));
+}
+
+float vk_noise::perlin_noise(float x, float y, uint32_t period)
+{
+    return lane0(::perlin_noise(splat(x), splat(y), period));
+}
+
+float vk_noise::fbm_periodic(float x, float y, uint32_t octaves, float h,
+                             uint32_t period, float time)
+{
+    return lane0(::fbm_periodic(splat(x), splat(y), octaves, h, period, time));
+}
+
+void vk_noise::cloudtex(thread_pool &pool, uint32_t size, std::vector<float> &texels)
+{
+    texels.resize((size_t)size * size * size * 4);
+
+    /* one row of x per index, W texels of it at a time */
+    pool.parallel_for(size * size, [&](uint32_t row) {
+        float *out = texels.data() + (size_t)row * size * 4;
+        vf s = splat((float)size);
+        vf uy = splat((float)(row % size)) / s;
+        vf uz = splat((float)(row / size)) / s;
+
+        for (uint32_t x = 0; x < size; x += W) {
+            vf ux = (splat((float)x) + iota()) / s;
+            float color[4][W];
+
+            store(color[0], fade(::fbm(ux, uy, uz, 3, 3.f)));
+            store(color[1], ::fbm_worley(ux, uy, uz, 4, 4.f));
+            store(color[2], ::fbm_worley(ux, uy, uz, 6, 6.f));
+            store(color[3], ::fbm_worley(ux, uy, uz, 8, 8.f));
+
+            for (uint32_t l = 0; l < std::min(W, size - x); ++l)
+                for (uint32_t c = 0; c < 4; ++c)
+                    out[(x + l) * 4 + c] = color[c][l];
+        }
+    });
+}
+
+void vk_noise::weather(thread_pool &pool, uint32_t size, int period, float time,
+                       float extent, std::vector<float> &texels)
+{
+    texels.resize((size_t)size * size);
+
+    pool.parallel_for(size, [&](uint32_t y) {
+        float *out = texels.data() + (size_t)y * size;
+
+        for (uint32_t x = 0; x < size; x += W) {
+            vf px = splat((float)x) + iota();
+            vf py = splat((float)y);
+            vf color;
+
+            if (period == 0) {
+                vf ux = px / splat(extent) * splat(weather_infreq);
+                vf uy = py / splat(extent) * splat(weather_infreq);
+                vf t = splat(time * .06f);
+                color = ::fbm(ux + t, uy + t, weather_octaves, weather_h);
+            } else {
+                vf ux = px / splat((float)size) * splat((float)period);
+                vf uy = py / splat((float)size) * splat((float)period);
+                color = ::fbm_periodic(ux, uy, weather_octaves, weather_h, period,
+                                       time * weather_evolve);
+            }
+
+            float values[W];
+            store(values, remap(color, .3f, 1.f, 0.f, 1.f));
+            std::copy(values, values + std::min(W, size - x), out + x);
+        }
+    });
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "vk_pool.h"
+
+/*
+    cpu port of the noise in cloudtex.comp and weather.comp, for machines
+    without a gpu and for checking shader changes against a reference.
+
+        thread_pool pool;
+        std::vector<float> texels;
+        vk_noise::cloudtex(pool, 128, texels);
+
+    volumes come out in the layout of the images, x fastest, "cloudtex" as
+    rgba and "weather" as r. the kernels run 8 lanes wide on avx2 builds,
+    4 on neon and 1 otherwise, see vk_noise::lanes.
+
+    worley and the random3f hash go through fract(sin(x) * 43758.5453), that
+    amplifies the last bit of sin and of the dot product before it, so only
+    perlin and the weather map match the gpu texel for texel. worley matches
+    in distribution.
+*/
+
+namespace vk_noise
+{
+extern const uint32_t lanes;
+
+/* cloudtex.comp */
+float perlin_noise(float x, float y, float z, float f);
+glm::vec3 random3f(glm::vec3 st);
+float worley_noise(float x, float y, float z, float f);
+float fbm(float x, float y, float z, uint32_t octaves, float infreq);
+float fbm_worley(float x, float y, float z, uint32_t octaves, float infreq);
+
+/* weather.comp, period 0 does not wrap */
+float perlin_noise(float x, float y, uint32_t period);
+float fbm_periodic(float x, float y, uint32_t octaves, float h, uint32_t period,
+                   float time);
+
+/* size^3 rgba texels */
+void cloudtex(thread_pool &pool, uint32_t size, std::vector<float> &texels);
+
+/*
+    size^2 texels, a period above 0 is the cached map at time, 0 the live one
+    where extent is the width weather.comp divides by
+*/
+void weather(thread_pool &pool, uint32_t size, int period, float time, float extent,
+             std::vector<float> &texels);
+} // namespace vk_noise
@@ -1,10 +1,43 @@
 #include "vk_pipeline.h"
 
+#include <chrono>
+#include <iostream>
+#include <mutex>
 #include <volk.h>
 
 #include "vk_boiler.h"
 #include "vk_type.h"
 
+static std::mutex feedback_mutex;
+
+/* VK_CHECK is gone under NDEBUG, a null pipeline must not go unnoticed */
+static void check_created(VkResult result)
+{
+    if (result != VK_SUCCESS) {
+        std::cerr << "pipeline queue: creating a pipeline failed: " << result
+                  << std::endl;
+        abort();
+    }
+}
+
+/* drivers without feedback leave it invalid, those count as misses */
+static void record_feedback(const VkPipelineCreationFeedback &feedback,
+                            std::chrono::steady_clock::time_point begin)
+{
+    auto end = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(feedback_mutex);
+    PipelineBuilder::_create_ms +=
+        std::chrono::duration<float, std::milli>(end - begin).count();
+
+    if ((feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) &&
+        (feedback.flags &
+         VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT))
+        PipelineBuilder::_cache_hits++;
+    else
+        PipelineBuilder::_cache_misses++;
+}
+
 void PipelineBuilder::build_layout(VkDevice device,
                                    std::vector<VkDescriptorSetLayout> &layouts,
                                    std::vector<VkPushConstantRange> &push_constants,
@@ -16,12 +49,32 @@ void PipelineBuilder::build_layout(VkDevice device,
     VK_CHECK(
         vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, pipeline_layout));
 
-    deletion_queue.push_back(
-        [=]() { vkDestroyPipelineLayout(device, *pipeline_layout, nullptr); });
+    /* by value, callers may build into locals */
+    VkPipelineLayout handle = *pipeline_layout;
+    deletion_queue.push_back([=]() { vkDestroyPipelineLayout(device, handle, nullptr); });
 }
 
 void PipelineBuilder::build_gfx(VkDevice device, VkFormat *format, VkFormat depth_format,
                                 VkPipelineLayout *pipeline_layout, VkPipeline *pipeline)
+{
+    VK_CHECK(create_gfx(device, _pipeline_cache, *format, depth_format,
+                        *pipeline_layout, pipeline));
+}
+
+void PipelineBuilder::build_comp(VkDevice device,
+                                 std::vector<VkDescriptorSetLayout> &layouts,
+                                 std::vector<VkPushConstantRange> &push_constants,
+                                 VkPipelineLayout *pipeline_layout, VkPipeline *pipeline,
+                                 const std::vector<uint32_t> &constants)
+{
+    build_layout(device, layouts, push_constants, pipeline_layout);
+    VK_CHECK(create_comp(device, _pipeline_cache, *pipeline_layout, pipeline, constants));
+}
+
+VkResult PipelineBuilder::create_gfx(VkDevice device, VkPipelineCache cache,
+                                     VkFormat format, VkFormat depth_format,
+                                     VkPipelineLayout pipeline_layout,
+                                     VkPipeline *pipeline)
 {
     VkPipelineViewportStateCreateInfo viewport_state_info = {};
     viewport_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -48,13 +101,19 @@ void PipelineBuilder::build_gfx(VkDevice device, VkFormat *format, VkFormat dept
     rendering_info.pNext = nullptr;
     // rendering_info.viewMask = ;
     rendering_info.colorAttachmentCount = 1;
-    rendering_info.pColorAttachmentFormats = format;
+    rendering_info.pColorAttachmentFormats = &format;
     rendering_info.depthAttachmentFormat = depth_format;
     // rendering_info.stencilAttachmentFormat = ;
 
+    VkPipelineCreationFeedback feedback = {};
+    VkPipelineCreationFeedbackCreateInfo feedback_info = {};
+    feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+    feedback_info.pNext = &rendering_info;
+    feedback_info.pPipelineCreationFeedback = &feedback;
+
     VkGraphicsPipelineCreateInfo graphics_pipeline_info = {};
     graphics_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    graphics_pipeline_info.pNext = &rendering_info;
+    graphics_pipeline_info.pNext = &feedback_info;
     // graphics_pipeline_info.flags = ;
     graphics_pipeline_info.stageCount = _shader_stage_infos.size();
     graphics_pipeline_info.pStages = _shader_stage_infos.data();
@@ -67,36 +126,228 @@ void PipelineBuilder::build_gfx(VkDevice device, VkFormat *format, VkFormat dept
     graphics_pipeline_info.pDepthStencilState = &_depth_stencil_state_info;
     graphics_pipeline_info.pColorBlendState = &color_blend_state_info;
     // graphics_pipeline_info.pDynamicState = ;
-    graphics_pipeline_info.layout = *pipeline_layout;
+    graphics_pipeline_info.layout = pipeline_layout;
     // graphics_pipeline_info.renderPass = ;
     // graphics_pipeline_info.subpass = ;
     graphics_pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
     // graphics_pipeline_info.basePipelineIndex = ;
 
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_info,
-                                       nullptr, pipeline));
+    auto begin = std::chrono::steady_clock::now();
+
+    VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &graphics_pipeline_info,
+                                                nullptr, pipeline);
 
-    deletion_queue.push_back([=]() { vkDestroyPipeline(device, *pipeline, nullptr); });
+    if (result != VK_SUCCESS) {
+        *pipeline = VK_NULL_HANDLE;
+        return result;
+    }
+
+    record_feedback(feedback, begin);
+
+    VkPipeline handle = *pipeline;
+    deletion_queue.push_back([=]() { vkDestroyPipeline(device, handle, nullptr); });
+    return VK_SUCCESS;
 }
 
-void PipelineBuilder::build_comp(VkDevice device,
-                                 std::vector<VkDescriptorSetLayout> &layouts,
-                                 std::vector<VkPushConstantRange> &push_constants,
-                                 VkPipelineLayout *pipeline_layout, VkPipeline *pipeline)
+VkResult PipelineBuilder::create_comp(VkDevice device, VkPipelineCache cache,
+                                      VkPipelineLayout pipeline_layout,
+                                      VkPipeline *pipeline,
+                                      const std::vector<uint32_t> &constants)
 {
-    build_layout(device, layouts, push_constants, pipeline_layout);
+    std::vector<VkSpecializationMapEntry> entries(constants.size());
+    for (uint32_t i = 0; i < constants.size(); ++i)
+        entries[i] = VkSpecializationMapEntry{i, i * (uint32_t)sizeof(uint32_t),
+                                              sizeof(uint32_t)};
+
+    VkSpecializationInfo specialization_info = {};
+    specialization_info.mapEntryCount = entries.size();
+    specialization_info.pMapEntries = entries.data();
+    specialization_info.dataSize = constants.size() * sizeof(uint32_t);
+    specialization_info.pData = constants.data();
+
+    VkPipelineShaderStageCreateInfo stage_info = _shader_stage_infos[0];
+    if (!constants.empty())
+        stage_info.pSpecializationInfo = &specialization_info;
+
+    VkPipelineCreationFeedback feedback = {};
+    VkPipelineCreationFeedbackCreateInfo feedback_info = {};
+    feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+    feedback_info.pNext = nullptr;
+    feedback_info.pPipelineCreationFeedback = &feedback;
 
     VkComputePipelineCreateInfo comp_pipeline_info = {};
     comp_pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    comp_pipeline_info.pNext = nullptr;
+    comp_pipeline_info.pNext = &feedback_info;
     // comp_pipeline_info.flags = ;
-    comp_pipeline_info.stage = _shader_stage_infos[0];
-    comp_pipeline_info.layout = *pipeline_layout;
+    comp_pipeline_info.stage = stage_info;
+    comp_pipeline_info.layout = pipeline_layout;
     comp_pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
     // comp_pipeline_info.basePipelineIndex = ;
 
-    VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &comp_pipeline_info,
-                                      nullptr, pipeline));
+    auto begin = std::chrono::steady_clock::now();
+
+    VkResult result = vkCreateComputePipelines(device, cache, 1, &comp_pipeline_info,
+                                               nullptr, pipeline);
+
+    if (result != VK_SUCCESS) {
+        *pipeline = VK_NULL_HANDLE;
+        return result;
+    }
 
-    deletion_queue.push_back([=]() { vkDestroyPipeline(device, *pipeline, nullptr); });
-}
\ No newline at end of file
+    record_feedback(feedback, begin);
+
+    VkPipeline handle = *pipeline;
+    deletion_queue.push_back([=]() { vkDestroyPipeline(device, handle, nullptr); });
+    return VK_SUCCESS;
+}
+
+void pipeline_queue::start(VkDevice device, VkPipelineCache cache, uint32_t count)
+{
+    this->device = device;
+    this->cache = cache;
+    count = count ? count : 1;
+
+    /* every worker starts from what the engine's cache already holds */
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, nullptr));
+
+    std::vector<char> data(size);
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, data.data()));
+
+    VkPipelineCacheCreateInfo pipeline_cache_info = {};
+    pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipeline_cache_info.pNext = nullptr;
+    pipeline_cache_info.initialDataSize = size;
+    pipeline_cache_info.pInitialData = size ? data.data() : nullptr;
+
+    caches.resize(count);
+    for (VkPipelineCache &c : caches)
+        VK_CHECK(vkCreatePipelineCache(device, &pipeline_cache_info, nullptr, &c));
+
+    quit = false;
+    for (uint32_t i = 0; i < count; ++i)
+        workers.emplace_back([this, i]() { work(i); });
+}
+
+VkPipeline *pipeline_queue::build_gfx(PipelineBuilder &pb, VkFormat format,
+                                      VkFormat depth_format,
+                                      VkPipelineLayout pipeline_layout)
+{
+    return push(job{pb, true, format, depth_format, pipeline_layout, {}, VK_NULL_HANDLE});
+}
+
+VkPipeline *pipeline_queue::build_comp(PipelineBuilder &pb, VkDevice device,
+                                       std::vector<VkDescriptorSetLayout> &layouts,
+                                       std::vector<VkPushConstantRange> &push_constants,
+                                       VkPipelineLayout *pipeline_layout,
+                                       const std::vector<uint32_t> &constants)
+{
+    pb.build_layout(device, layouts, push_constants, pipeline_layout);
+
+    return create_comp(pb, *pipeline_layout, constants);
+}
+
+VkPipeline *pipeline_queue::create_comp(PipelineBuilder &pb,
+                                        VkPipelineLayout pipeline_layout,
+                                        const std::vector<uint32_t> &constants)
+{
+    return push(job{pb, false, VK_FORMAT_UNDEFINED, VK_FORMAT_UNDEFINED, pipeline_layout,
+                    constants, VK_NULL_HANDLE});
+}
+
+VkPipeline *pipeline_queue::push(job &&j)
+{
+    VkPipeline *pipeline;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(j));
+        pipeline = &jobs.back().pipeline;
+    }
+
+    wake.notify_one();
+    return pipeline;
+}
+
+void pipeline_queue::wait(VkPipeline *pipeline)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    /* the slot is the pipeline member of its job */
+    job *j = nullptr;
+    for (job &k : jobs)
+        if (&k.pipeline == pipeline)
+            j = &k;
+
+    if (!j)
+        return;
+
+    /* on completion, a failed job never fills the slot */
+    done.wait(lock, [&]() { return j->done; });
+    check_created(j->result);
+}
+
+void pipeline_queue::finish()
+{
+    if (workers.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+
+    wake.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    workers.clear();
+
+    /* nobody may have waited on a failed slot */
+    for (job &j : jobs)
+        check_created(j.result);
+
+    VK_CHECK(vkMergePipelineCaches(device, cache, caches.size(), caches.data()));
+
+    for (VkPipelineCache c : caches)
+        vkDestroyPipelineCache(device, c, nullptr);
+
+    caches.clear();
+}
+
+void pipeline_queue::work(uint32_t self)
+{
+    for (;;) {
+        job *j;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return quit || next < jobs.size(); });
+
+            /* quitting only once the queue is drained */
+            if (next == jobs.size())
+                return;
+
+            j = &jobs[next++];
+        }
+
+        VkPipeline pipeline;
+        VkResult result;
+        if (j->gfx)
+            result = j->pb.create_gfx(device, caches[self], j->format, j->depth_format,
+                                      j->pipeline_layout, &pipeline);
+        else
+            result = j->pb.create_comp(device, caches[self], j->pipeline_layout,
+                                       &pipeline, j->constants);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            j->pipeline = pipeline;
+            j->result = result;
+            j->done = true;
+        }
+
+        done.notify_all();
+    }
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <volk.h>
 
@@ -16,6 +20,12 @@ public:
     VkPipelineMultisampleStateCreateInfo _multisample_state_info;
     VkPipelineDepthStencilStateCreateInfo _depth_stencil_state_info;
 
+    /* every pipeline goes through the engine's cache, hits counted by feedback */
+    inline static VkPipelineCache _pipeline_cache = VK_NULL_HANDLE;
+    inline static uint32_t _cache_hits = 0;
+    inline static uint32_t _cache_misses = 0;
+    inline static float _create_ms = 0.f;
+
     void build_layout(VkDevice device, std::vector<VkDescriptorSetLayout> &layouts,
                       std::vector<VkPushConstantRange> &push_constants,
                       VkPipelineLayout *pipeline_layout);
@@ -23,7 +33,99 @@ public:
     void build_gfx(VkDevice device, VkFormat *format, VkFormat depth_format,
                    VkPipelineLayout *pipeline_layout, VkPipeline *pipeline);
 
+    /* constants[i] specializes constant_id i of the shader, all 32 bit */
     void build_comp(VkDevice device, std::vector<VkDescriptorSetLayout> &layouts,
                     std::vector<VkPushConstantRange> &push_constants,
-                    VkPipelineLayout *pipeline_layout, VkPipeline *pipeline);
+                    VkPipelineLayout *pipeline_layout, VkPipeline *pipeline,
+                    const std::vector<uint32_t> &constants = {});
+
+    /*
+        the pipeline alone, into cache, safe from any thread with its own cache.
+        the result is returned rather than checked, the caller reports it
+    */
+    VkResult create_gfx(VkDevice device, VkPipelineCache cache, VkFormat format,
+                        VkFormat depth_format, VkPipelineLayout pipeline_layout,
+                        VkPipeline *pipeline);
+
+    VkResult create_comp(VkDevice device, VkPipelineCache cache,
+                         VkPipelineLayout pipeline_layout, VkPipeline *pipeline,
+                         const std::vector<uint32_t> &constants);
+};
+
+/*
+    Pipelines compiled on worker threads while init goes on. Each worker
+    compiles into a cache of its own, seeded from the one given to start,
+    finish merges them back into it.
+
+        queue.start(device, cache);
+        VkPipeline *pipeline =
+            queue.build_comp(pb, device, layouts, push_constants, &pipeline_layout);
+        ...
+        queue.wait(pipeline);   // before recording with it
+        ...
+        queue.finish();         // every slot is filled from here on
+
+    layouts are created at once on the calling thread, the slots stay where
+    they are as long as the queue lives.
+*/
+
+struct pipeline_queue {
+public:
+    pipeline_queue() = default;
+    ~pipeline_queue() { finish(); };
+
+    pipeline_queue(const pipeline_queue &) = delete;
+    pipeline_queue &operator=(const pipeline_queue &) = delete;
+
+    void start(VkDevice device, VkPipelineCache cache,
+               uint32_t count = std::thread::hardware_concurrency());
+
+    VkPipeline *build_gfx(PipelineBuilder &pb, VkFormat format, VkFormat depth_format,
+                          VkPipelineLayout pipeline_layout);
+
+    VkPipeline *build_comp(PipelineBuilder &pb, VkDevice device,
+                           std::vector<VkDescriptorSetLayout> &layouts,
+                           std::vector<VkPushConstantRange> &push_constants,
+                           VkPipelineLayout *pipeline_layout,
+                           const std::vector<uint32_t> &constants = {});
+
+    /* with a layout built before, variants of one shader share it */
+    VkPipeline *create_comp(PipelineBuilder &pb, VkPipelineLayout pipeline_layout,
+                            const std::vector<uint32_t> &constants = {});
+
+    /* blocks until the slot is filled, aborts when creating it failed */
+    void wait(VkPipeline *pipeline);
+
+    void finish();
+
+private:
+    struct job {
+        PipelineBuilder pb;
+        bool gfx;
+        VkFormat format;
+        VkFormat depth_format;
+        VkPipelineLayout pipeline_layout;
+        std::vector<uint32_t> constants;
+        VkPipeline pipeline;
+        /* set by the worker, pipeline stays null when result is an error */
+        VkResult result = VK_SUCCESS;
+        bool done = false;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+
+    std::vector<std::thread> workers;
+    std::vector<VkPipelineCache> caches;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    /* a deque, slots handed out keep their address as jobs are added */
+    std::deque<job> jobs;
+    size_t next = 0;
+    bool quit = false;
+
+    VkPipeline *push(job &&j);
+    void work(uint32_t self);
 };
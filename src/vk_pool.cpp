@@ -0,0 +1,148 @@
+#include "vk_pool.h"
+
+static uint64_t pack(uint32_t begin, uint32_t end)
+{
+    return (uint64_t)end << 32 | begin;
+}
+
+thread_pool::thread_pool(uint32_t count)
+{
+    count = count ? count : 1;
+    shares.reset(new share[count]);
+
+    for (uint32_t i = 0; i < count; ++i)
+        shares[i].range = 0;
+
+    /* the caller of parallel_for is one of the threads */
+    for (uint32_t i = 1; i < count; ++i)
+        workers.emplace_back([this, i]() { work(i); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+
+    wake.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void thread_pool::parallel_for(uint32_t count, const std::function<void(uint32_t)> &f)
+{
+    if (!count)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &f;
+
+        uint64_t n = size();
+        for (uint64_t i = 0; i < n; ++i)
+            shares[i].range = pack(count * i / n, count * (i + 1) / n);
+
+        busy = workers.size();
+        generation++;
+    }
+
+    wake.notify_all();
+    drain(f, 0);
+
+    /* a worker may still be inside its last index */
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return busy == 0; });
+    job = nullptr;
+}
+
+void thread_pool::work(uint32_t self)
+{
+    uint64_t seen = 0;
+
+    for (;;) {
+        const std::function<void(uint32_t)> *f;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return quit || generation != seen; });
+
+            if (quit)
+                return;
+
+            seen = generation;
+            f = job;
+        }
+
+        drain(*f, self);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+
+        done.notify_one();
+    }
+}
+
+void thread_pool::drain(const std::function<void(uint32_t)> &f, uint32_t self)
+{
+    uint32_t i;
+
+    for (;;) {
+        while (pop(self, i))
+            f(i);
+
+        /* nothing left anywhere, the other threads finish what they hold */
+        if (!steal(self))
+            return;
+    }
+}
+
+bool thread_pool::pop(uint32_t self, uint32_t &i)
+{
+    std::atomic<uint64_t> &range = shares[self].range;
+    uint64_t r = range.load();
+
+    for (;;) {
+        uint32_t begin = (uint32_t)r;
+        uint32_t end = (uint32_t)(r >> 32);
+
+        if (begin >= end)
+            return false;
+
+        if (range.compare_exchange_weak(r, pack(begin + 1, end))) {
+            i = begin;
+            return true;
+        }
+    }
+}
+
+bool thread_pool::steal(uint32_t self)
+{
+    uint32_t n = size();
+
+    for (uint32_t k = 1; k < n; ++k) {
+        std::atomic<uint64_t> &victim = shares[(self + k) % n].range;
+        uint64_t r = victim.load();
+
+        for (;;) {
+            uint32_t begin = (uint32_t)r;
+            uint32_t end = (uint32_t)(r >> 32);
+
+            if (begin >= end)
+                break;
+
+            /* the back half, the victim keeps working from the front */
+            uint32_t mid = begin + (end - begin) / 2;
+
+            if (victim.compare_exchange_weak(r, pack(begin, mid))) {
+                shares[self].range = pack(mid, end);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
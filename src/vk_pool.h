@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Fixed set of worker threads, the calling thread works along with them.
+
+        thread_pool pool;
+        pool.parallel_for(rows, [&](uint32_t row) { ... });
+
+    every thread starts on its own contiguous share of the indices and takes
+    them from the front, one that runs dry steals the back half of another
+    share. neighbouring indices, tiles or rows, mostly stay on one thread.
+*/
+
+struct thread_pool {
+public:
+    thread_pool(uint32_t count = std::thread::hardware_concurrency());
+    ~thread_pool();
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    /* f(i) for every i below count, returns once all of them are done */
+    void parallel_for(uint32_t count, const std::function<void(uint32_t)> &f);
+
+    inline uint32_t size() { return workers.size() + 1; };
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    /* [begin, end) of each thread, begin in the low half, caller first */
+    struct alignas(64) share {
+        std::atomic<uint64_t> range;
+    };
+
+    std::unique_ptr<share[]> shares;
+
+    const std::function<void(uint32_t)> *job = nullptr;
+    uint32_t busy = 0;
+    uint64_t generation = 0;
+    bool quit = false;
+
+    void work(uint32_t self);
+    void drain(const std::function<void(uint32_t)> &f, uint32_t self);
+    bool pop(uint32_t self, uint32_t &i);
+    bool steal(uint32_t self);
+};
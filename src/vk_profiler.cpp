@@ -0,0 +1,219 @@
+#include "vk_profiler.h"
+
+#include <iostream>
+
+#include "vk_type.h"
+
+void gpu_profiler::init(VkDevice device, VkPhysicalDevice physical_device,
+                        uint32_t gfx_index, uint32_t comp_index, uint32_t frame_count)
+{
+    this->device = device;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                             families.data());
+
+    uint32_t valid_bits = 0;
+    if (gfx_index < family_count)
+        valid_bits = families[gfx_index].timestampValidBits;
+
+    /* graphics and compute passes share one queue, both need timestamps */
+    if (!properties.limits.timestampComputeAndGraphics || !valid_bits) {
+        std::cerr << "gpu profiler: timestamps not supported" << std::endl;
+        return;
+    }
+
+    period = properties.limits.timestampPeriod;
+    init_queue(&queues[GRAPHICS], valid_bits, frame_count);
+
+    if (comp_index != gfx_index) {
+        valid_bits = 0;
+        if (comp_index < family_count)
+            valid_bits = families[comp_index].timestampValidBits;
+
+        if (valid_bits)
+            init_queue(&queues[COMPUTE], valid_bits, frame_count);
+        else
+            std::cerr << "gpu profiler: no timestamps on the compute queue, async passes "
+                         "are not timed"
+                      << std::endl;
+    }
+
+    enabled = true;
+}
+
+void gpu_profiler::init_queue(query_queue *queue, uint32_t valid_bits,
+                              uint32_t frame_count)
+{
+    queue->mask = valid_bits == 64 ? ~0ull : (1ull << valid_bits) - 1;
+    queue->frames.resize(frame_count);
+
+    for (query_frame &frame : queue->frames) {
+        VkQueryPoolCreateInfo query_pool_info = {};
+        query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_info.pNext = nullptr;
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = MAX_QUERIES;
+
+        VK_CHECK(vkCreateQueryPool(device, &query_pool_info, nullptr, &frame.pool));
+
+        VkQueryPool pool = frame.pool;
+        deletion_queue.push_back([=]() { vkDestroyQueryPool(device, pool, nullptr); });
+
+        /* nothing was written yet, the first begin_frame resets the pool */
+        frame.count = 0;
+        frame.frame_number = 0;
+    }
+}
+
+bool gpu_profiler::open(const char *filename)
+{
+    csv.open(filename);
+
+    if (!csv.is_open()) {
+        std::cerr << "gpu profiler: failed to open " << filename << std::endl;
+        return false;
+    }
+
+    csv << "frame,pass,ms" << std::endl;
+    return true;
+}
+
+void gpu_profiler::begin_frame(VkCommandBuffer cbuffer, uint32_t frame_index,
+                               uint64_t frame_number, uint32_t queue)
+{
+    query_queue *q = &queues[queue];
+
+    if (!enabled || q->frames.empty())
+        return;
+
+    query_frame *current = q->current = &q->frames[frame_index];
+
+    /* the fence of this slot was waited on, the results are available */
+    resolve(q, current);
+
+    vkCmdResetQueryPool(cbuffer, current->pool, 0, MAX_QUERIES);
+    current->count = 0;
+    current->frame_number = frame_number;
+    current->passes.clear();
+}
+
+uint32_t gpu_profiler::begin(VkCommandBuffer cbuffer, std::string name, uint32_t queue)
+{
+    query_frame *current = queues[queue].current;
+
+    if (!enabled || !current || current->count + 2 > MAX_QUERIES)
+        return UINT32_MAX;
+
+    query_pass pass = {};
+    pass.name = name;
+    pass.begin = current->count++;
+    pass.end = current->count++;
+
+    vkCmdWriteTimestamp(cbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->pool,
+                        pass.begin);
+
+    current->passes.push_back(pass);
+    return current->passes.size() - 1;
+}
+
+void gpu_profiler::end(VkCommandBuffer cbuffer, uint32_t query, uint32_t queue)
+{
+    query_frame *current = queues[queue].current;
+
+    if (!enabled || !current || query >= current->passes.size())
+        return;
+
+    vkCmdWriteTimestamp(cbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->pool,
+                        current->passes[query].end);
+}
+
+float gpu_profiler::get_avg(std::string name)
+{
+    for (pass_stat &stat : stats)
+        if (stat.name == name)
+            return stat.avg_ms;
+
+    return 0.f;
+}
+
+void gpu_profiler::reset_stats()
+{
+    stats.clear();
+    windows.clear();
+}
+
+void gpu_profiler::flush()
+{
+    if (!enabled)
+        return;
+
+    for (query_queue &queue : queues)
+        for (query_frame &frame : queue.frames) {
+            resolve(&queue, &frame);
+            frame.passes.clear();
+
+            /* results are consumed, the next begin_frame resets the pools anyway */
+            frame.count = 0;
+        }
+}
+
+void gpu_profiler::resolve(query_queue *queue, query_frame *frame)
+{
+    if (!frame->count)
+        return;
+
+    std::vector<uint64_t> timestamps(frame->count);
+
+    VkResult result = vkGetQueryPoolResults(
+        device, frame->pool, 0, frame->count, timestamps.size() * sizeof(uint64_t),
+        timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+    if (result != VK_SUCCESS)
+        return;
+
+    for (query_pass &pass : frame->passes) {
+        uint64_t ticks = (timestamps[pass.end] - timestamps[pass.begin]) & queue->mask;
+        float ms = ticks * period / 1000000.f;
+
+        record(pass.name, ms);
+
+        if (csv.is_open())
+            csv << frame->frame_number << "," << pass.name << "," << ms << "\n";
+    }
+}
+
+void gpu_profiler::record(std::string name, float ms)
+{
+    uint32_t i = 0;
+    while (i < stats.size() && stats[i].name != name)
+        ++i;
+
+    if (i == stats.size()) {
+        stats.push_back(pass_stat{name, 0.f, 0.f, 0.0, 0});
+        windows.push_back(rolling{});
+    }
+
+    /* rolling average over the last WINDOW frames */
+    rolling &window = windows[i];
+    if (window.count == WINDOW)
+        window.sum -= window.samples[window.next];
+    else
+        window.count++;
+
+    window.samples[window.next] = ms;
+    window.next = (window.next + 1) % WINDOW;
+    window.sum += ms;
+
+    stats[i].ms = ms;
+    stats[i].avg_ms = window.sum / window.count;
+
+    /* mean since the last reset_stats */
+    stats[i].samples++;
+    stats[i].mean_ms += (ms - stats[i].mean_ms) / stats[i].samples;
+}
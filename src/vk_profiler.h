@@ -0,0 +1,101 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <volk.h>
+
+/*
+    Timestamp queries around each pass, one query pool per frame in flight.
+    Results of a frame slot are read back when that slot is recorded again,
+    its fence has already been waited on, so reading never stalls.
+
+        uint32_t q = profiler.begin(cbuffer, "cloud");
+        ...
+        profiler.end(cbuffer, q);
+
+    A separate compute family gets pools of its own, passes recorded on it
+    pass COMPUTE after begin_frame on the compute cbuffer. Both end up in
+    the same stats and csv.
+*/
+
+struct pass_stat {
+    std::string name;
+    float ms;
+    float avg_ms;
+    double mean_ms;
+    uint64_t samples;
+};
+
+struct gpu_profiler {
+public:
+    static constexpr uint32_t MAX_QUERIES = 64;
+    static constexpr uint32_t WINDOW = 64;
+
+    /* queue a cbuffer is submitted to */
+    static constexpr uint32_t GRAPHICS = 0;
+    static constexpr uint32_t COMPUTE = 1;
+
+    bool enabled = false;
+
+    /* comp_index equal to gfx_index leaves COMPUTE without pools */
+    void init(VkDevice device, VkPhysicalDevice physical_device, uint32_t gfx_index,
+              uint32_t comp_index, uint32_t frame_count);
+
+    bool open(const char *filename);
+
+    void begin_frame(VkCommandBuffer cbuffer, uint32_t frame_index, uint64_t frame_number,
+                     uint32_t queue = GRAPHICS);
+
+    uint32_t begin(VkCommandBuffer cbuffer, std::string name, uint32_t queue = GRAPHICS);
+    void end(VkCommandBuffer cbuffer, uint32_t query, uint32_t queue = GRAPHICS);
+
+    inline const std::vector<pass_stat> &get_stats() { return stats; };
+
+    float get_avg(std::string name);
+
+    void reset_stats();
+
+    /* resolve every pending slot, the device must be idle */
+    void flush();
+
+private:
+    struct query_pass {
+        std::string name;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    struct query_frame {
+        VkQueryPool pool;
+        uint32_t count;
+        uint64_t frame_number;
+        std::vector<query_pass> passes;
+    };
+
+    /* timestampValidBits differ per family */
+    struct query_queue {
+        uint64_t mask;
+        std::vector<query_frame> frames;
+        query_frame *current = nullptr;
+    };
+
+    struct rolling {
+        float samples[WINDOW];
+        uint32_t count;
+        uint32_t next;
+        float sum;
+    };
+
+    VkDevice device;
+    float period;
+    query_queue queues[2];
+
+    std::vector<pass_stat> stats;
+    std::vector<rolling> windows;
+    std::ofstream csv;
+
+    void init_queue(query_queue *queue, uint32_t valid_bits, uint32_t frame_count);
+    void resolve(query_queue *queue, query_frame *frame);
+    void record(std::string name, float ms);
+};
@@ -0,0 +1,388 @@
+#include "vk_raymarch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/trigonometric.hpp>
+
+#include "vk_simd.h"
+
+using namespace vk_simd;
+
+namespace
+{
+/* as in cloud.comp and light.comp */
+const glm::vec3 light_min = glm::vec3(-950.f, 0.f, -950.f);
+const glm::vec3 light_max = glm::vec3(950.f, 950.f, 950.f);
+const float inner_radius = 150.f;
+const float shell = 800.f;
+
+/* pixels of a tile, rows of W lanes */
+const uint32_t tile = 16;
+
+struct v3 {
+    vf x, y, z;
+};
+
+inline v3 splat3(glm::vec3 a) { return { splat(a.x), splat(a.y), splat(a.z) }; }
+inline v3 operator+(v3 a, v3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline v3 operator-(v3 a, v3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline v3 operator*(v3 a, vf b) { return { a.x * b, a.y * b, a.z * b }; }
+inline vf dot(v3 a, v3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline vf length(v3 a) { return vsqrt(dot(a, a)); }
+
+inline v3 normalize(v3 a)
+{
+    vf l = length(a);
+    return { a.x / l, a.y / l, a.z / l };
+}
+
+inline vf remap(vf value, vf old_min, vf old_max, float new_min, float new_max)
+{
+    vf t = splat(new_min) +
+           ((value - old_min) / (old_max - old_min)) * splat(new_max - new_min);
+    return vmin(vmax(t, splat(new_min)), splat(new_max));
+}
+
+inline vf remap(vf value, float old_min, float old_max, float new_min, float new_max)
+{
+    return remap(value, splat(old_min), splat(old_max), new_min, new_max);
+}
+
+inline float remap(float value, float old_min, float old_max, float new_min,
+                   float new_max)
+{
+    float t = new_min + ((value - old_min) / (old_max - old_min)) * (new_max - new_min);
+    return std::min(std::max(t, new_min), new_max);
+}
+
+inline vf smoothstep(float edge0, float edge1, vf x)
+{
+    vf t = (x - splat(edge0)) / splat(edge1 - edge0);
+    t = vmin(vmax(t, splat(0.f)), splat(1.f));
+    return t * t * (splat(3.f) - splat(2.f) * t);
+}
+
+inline vf mix(vf a, vf b, vf t) { return a + (b - a) * t; }
+
+inline vf rand(vf x) { return fract(vsin(x) * splat(100000.f)) - splat(.5f); }
+
+/* a texel in bounds or 0, what an out of range imageLoad returns */
+inline vi bounded(vm in, vi index) { return select(in, index, splat(0)); }
+
+vf eval_density(const vk_raymarch::volumes &volumes, const cloud_data &cloud, v3 p,
+                vf height)
+{
+    /* a cached weather map is periodic, scroll it instead of regenerating */
+    vf ux = p.x * splat(.19f) - splat(-256.f) + splat(cloud.weather_offset.x);
+    vf uy = p.z * splat(.19f) - splat(-256.f) + splat(cloud.weather_offset.y);
+
+    float size = (float)volumes.weather_size;
+    if (cloud.weather_wrap != 0) {
+        ux = vmod(ux, size);
+        uy = vmod(uy, size);
+    }
+
+    vi wx = to_int(ux);
+    vi wy = to_int(uy);
+    vi wsize = splat((int32_t)volumes.weather_size);
+    vm win = andnot((wx < wsize) & (wy < wsize), (wx < splat(0)) | (wy < splat(0)));
+
+    vi windex = bounded(win, wy * wsize + wx);
+    vf coverage = select(win, gather(volumes.weather.data(), windex), splat(0.f));
+
+    vi nx = to_int(p.x * splat(cloud.freq)) & splat(127);
+    vi ny = to_int(p.y * splat(cloud.freq)) & splat(127);
+    vi nz = to_int(p.z * splat(cloud.freq)) & splat(127);
+    vi nsize = splat((int32_t)volumes.cloudtex_size);
+    vm nin = (nx < nsize) & (ny < nsize) & (nz < nsize);
+    vi index = bounded(nin, ((nz * nsize + ny) * nsize + nx) * splat(4));
+
+    const float *texels = volumes.cloudtex.data();
+    vf d[4];
+    for (uint32_t c = 0; c < 4; ++c)
+        d[c] = select(nin, gather(texels + c, index), splat(0.f));
+
+    vf low_freq_worley = d[1] + d[2] + d[3];
+    vf x = remap(d[0], 1.f - cloud.density, 1.f, 0.f, 1.f);
+    x = remap(x, splat(1.f) - coverage, splat(1.f), 0.f, 1.f);
+    x = remap(x, low_freq_worley - splat(1.3f), splat(1.f), 0.f, 1.f);
+
+    float lowerupperlimit = remap(cloud.type, 0.f, 1.f, .11f, .25f);
+    float upperlowerlimit = remap(cloud.type, 0.f, 1.f, .13f, .75f);
+    float upperupperlimit = remap(cloud.type, 0.f, 1.f, .14f, .89f);
+
+    vf type = splat(1.f);
+    type = select(height < splat(lowerupperlimit),
+                  smoothstep(.1f, lowerupperlimit, height), type);
+    type = select(height > splat(upperlowerlimit),
+                  smoothstep(upperupperlimit, upperlowerlimit, height), type);
+    x = remap(x, splat(1.f) - type, splat(1.f), 0.f, 1.f);
+
+    x = remap(x, cloud.cutoff, 1.f, 0.f, 1.f);
+    vf density = x * splat(cloud.density) * coverage * type * height;
+
+    return select(coverage < splat(.02f), splat(0.f), density);
+}
+
+/* trilinear over the 8 texels around p, clamped to the edge */
+vf light_tau(const vk_raymarch::volumes &volumes, v3 p)
+{
+    glm::vec3 size = glm::vec3(volumes.light_size);
+    glm::vec3 scale = size / (light_max - light_min);
+
+    vf u[3] = {
+        (p.x - splat(light_min.x)) * splat(scale.x) - splat(.5f),
+        (p.y - splat(light_min.y)) * splat(scale.y) - splat(.5f),
+        (p.z - splat(light_min.z)) * splat(scale.z) - splat(.5f),
+    };
+
+    vf base[3], f[3];
+    for (uint32_t c = 0; c < 3; ++c) {
+        base[c] = vfloor(u[c]);
+        f[c] = u[c] - base[c];
+    }
+
+    vf tau[8];
+    for (int32_t i = 0; i < 8; ++i) {
+        vi tap[3];
+        for (int32_t c = 0; c < 3; ++c) {
+            vf t = base[c] + splat((float)((i >> c) & 1));
+            tap[c] = to_int(vmin(vmax(t, splat(0.f)), splat(size[c] - 1.f)));
+        }
+
+        vi index = (tap[2] * splat((int32_t)volumes.light_size.y) + tap[1]) *
+                       splat((int32_t)volumes.light_size.x) +
+                   tap[0];
+        tau[i] = gather(volumes.light.data(), index);
+    }
+
+    vf x0 = mix(tau[0], tau[1], f[0]);
+    vf x1 = mix(tau[2], tau[3], f[0]);
+    vf x2 = mix(tau[4], tau[5], f[0]);
+    vf x3 = mix(tau[6], tau[7], f[0]);
+    return mix(mix(x0, x1, f[1]), mix(x2, x3, f[1]), f[2]);
+}
+
+/* centred at the origin, (-1, -1) on a miss */
+void hit_sphere(float radius, v3 o, v3 r, vf &t0, vf &t1)
+{
+    vf a = dot(r, r);
+    vf b = splat(-2.f) * dot(r, splat3(glm::vec3(0.f)) - o);
+    vf c = dot(o, o) - splat(radius * radius);
+    vf discriminant = b * b - splat(4.f) * a * c;
+
+    vf s = vsqrt(vmax(discriminant, splat(0.f)));
+    vm hit = discriminant >= splat(0.f);
+    t0 = select(hit, (splat(0.f) - b - s) / splat(2.f) * a, splat(-1.f));
+    t1 = select(hit, (splat(0.f) - b + s) / splat(2.f) * a, splat(-1.f));
+}
+
+inline vf phase(float g, v3 a, v3 b)
+{
+    vf cos_theta = dot(a, b);
+    vf denom = splat(1.f + g * g) - splat(2.f * g) * cos_theta;
+    return splat(1.f / (4.f * 3.14f) * (1.f - g * g)) / (denom * vsqrt(denom));
+}
+} // namespace
+
+void vk_raymarch::light(thread_pool &pool, const cloud_data &cloud, volumes &volumes)
+{
+    glm::uvec3 size = volumes.light_size;
+    volumes.light.resize((size_t)size.x * size.y * size.z);
+
+    glm::vec3 ld = glm::normalize(cloud.sun_dir);
+    float nstep = 6.f * cloud.step;
+    v3 march = splat3(ld * nstep);
+
+    pool.parallel_for(size.y * size.z, [&](uint32_t row) {
+        float *out = volumes.light.data() + (size_t)row * size.x;
+        float y = (float)(row % size.y);
+        float z = (float)(row / size.y);
+        glm::vec3 extent = light_max - light_min;
+
+        for (uint32_t x = 0; x < size.x; x += W) {
+            vf px = splat((float)x) + iota();
+
+            v3 p = {
+                splat(light_min.x) + (px + splat(.5f)) / splat((float)size.x) *
+                                         splat(extent.x),
+                splat(light_min.y + (y + .5f) / size.y * extent.y),
+                splat(light_min.z + (z + .5f) / size.z * extent.z),
+            };
+
+            vf tau = splat(0.f);
+            for (int j = 0; j < 6; ++j) {
+                p = p + march;
+                vf nheight = (length(p) - splat(inner_radius)) / splat(shell);
+                tau = tau + eval_density(volumes, cloud, p, nheight);
+            }
+
+            float values[W];
+            store(values, tau);
+            std::copy(values, values + std::min(W, size.x - x), out + x);
+        }
+    });
+}
+
+void vk_raymarch::trace(thread_pool &pool, const volumes &volumes,
+                        const cloud_data &cloud, const camera_data &camera,
+                        uint32_t width, uint32_t height, std::vector<uint16_t> &rgba)
+{
+    rgba.resize((size_t)width * height * 4);
+
+    glm::vec2 res = glm::vec2(width, height);
+    glm::vec3 d = camera.dir;
+    glm::vec3 left = glm::normalize(glm::cross(camera.up, d));
+    glm::vec3 up = glm::normalize(glm::cross(d, left));
+
+    float h = std::tan(glm::radians(camera.fov) / 2.f);
+    glm::vec3 upperleft = (camera.pos + res.y / 2.f / h * d) + left * res.x / 2.f +
+                          up * res.y / 2.f;
+
+    float camera_radius = glm::length(camera.pos);
+    float outer_radius = inner_radius + shell;
+
+    glm::vec3 ld = glm::normalize(cloud.sun_dir);
+    float step = cloud.step;
+    float nstep = 6.f * step;
+    float sigma_s = cloud.sigma_s;
+    float sigma_t = cloud.sigma_a + cloud.sigma_s;
+
+    uint32_t tiles_x = (width + tile - 1) / tile;
+    uint32_t tiles_y = (height + tile - 1) / tile;
+
+    pool.parallel_for(tiles_x * tiles_y, [&](uint32_t index) {
+        uint32_t tx = index % tiles_x * tile;
+        uint32_t ty = index / tiles_x * tile;
+
+        for (uint32_t y = ty; y < std::min(ty + tile, height); ++y)
+            for (uint32_t x = tx; x < std::min(tx + tile, width); x += W) {
+                v3 o = splat3(camera.pos);
+                vf ux = (splat((float)x) + iota()) / splat(res.x) * splat(res.x);
+                vf uy = splat((float)y / res.y * res.y);
+
+                v3 r = splat3(upperleft) - splat3(left) * ux - splat3(up) * uy - o;
+                r = normalize(r);
+
+                /* intersect */
+                vf inner0, inner1, outer0, outer1;
+                hit_sphere(inner_radius, o, r, inner0, inner1);
+                hit_sphere(outer_radius, o, r, outer0, outer1);
+
+                vm inside = (inner0 < splat(0.f)) & (inner1 >= splat(0.f));
+                inner0 = select(inside, splat(0.f), inner0);
+                inside = (outer0 < splat(0.f)) & (outer1 >= splat(0.f));
+                outer0 = select(inside, splat(0.f), outer0);
+
+                vf t0 = splat(-1.f);
+                vf t1 = splat(-1.f);
+
+                if (camera_radius < inner_radius) {
+                    t0 = inner1;
+                    t1 = outer1;
+                }
+
+                if (camera_radius > inner_radius && camera_radius < outer_radius) {
+                    t0 = splat(0.f);
+                    t1 = outer1;
+                }
+
+                if (camera_radius > outer_radius) {
+                    t0 = outer0;
+                    t1 = outer1;
+                }
+
+                vf transmittance = splat(1.f);
+                v3 color = splat3(glm::vec3(0.f));
+
+                /* in volume marching, lanes drop out of active on their own */
+                vm active = t0 >= splat(0.f);
+                vf np_y = o.y + t1 * r.y;
+                vf count = splat(0.f);
+
+                vf jitter = splat(step) + splat(step) * rand(t1);
+                t0 = t0 + jitter;
+                t1 = t1 + jitter;
+
+                for (;;) {
+                    active = active & (t0 < t1);
+                    if (!any(active))
+                        break;
+
+                    v3 p = o + r * t0;
+
+                    /* dome check */
+                    vm below = active & (p.y < splat(0.f));
+                    active = andnot(active, below & (np_y < splat(0.f)));
+                    below = active & below;
+
+                    vf skip = splat(step) + splat(step) * rand(t0);
+                    t0 = select(below, t0 + splat(10.f) * skip, t0);
+
+                    vm live = andnot(active, below);
+                    vf height = (length(p) - splat(inner_radius)) / splat(shell);
+                    vf density = eval_density(volumes, cloud, p, height);
+
+                    vm sparse = live & (density < splat(.02f));
+                    t0 = select(sparse, t0 + splat(20.f) * skip, t0);
+
+                    vm hit = andnot(live, sparse);
+                    if (!any(hit))
+                        continue;
+
+                    transmittance = select(
+                        hit, transmittance * vexp(splat(-step * sigma_t) * density),
+                        transmittance);
+
+                    /* estimate in-scattering to p in volume */
+                    vf tau = light_tau(volumes, p);
+                    v3 l = splat3(ld);
+
+                    vf fr = splat(3.f) * phase(.3f, l, r) +
+                            splat(1.5f) * phase(.6f, l, r) +
+                            splat(.3f) * phase(.9f, l, r) +
+                            splat(.3f) * phase(-.3f, l, r);
+                    vf shadow = vexp(splat(-nstep * sigma_t) * tau);
+                    vf ambient = splat(cloud.ambient) *
+                                 remap(height, 0.f, 1.f, .6f, 1.f) * shadow;
+
+                    vf scatter = select(hit, transmittance * splat(sigma_s) * density *
+                                                 splat(step),
+                                        splat(0.f));
+                    glm::vec3 sky = glm::vec3(.6f, .9f, 1.f);
+                    glm::vec3 sun = cloud.sun_color;
+                    color.x = color.x + scatter * (splat(sun.x) * fr * shadow +
+                                                   splat(sky.x) * ambient);
+                    color.y = color.y + scatter * (splat(sun.y) * fr * shadow +
+                                                   splat(sky.y) * ambient);
+                    color.z = color.z + scatter * (splat(sun.z) * fr * shadow +
+                                                   splat(sky.z) * ambient);
+
+                    t0 = select(hit, t0 + splat(step) + splat(step) * rand(t0), t0);
+                    count = select(hit, count + splat(1.f), count);
+
+                    vm done = (count > splat((float)cloud.max_steps)) |
+                              (transmittance < splat(step) + splat(step) * rand(t0));
+                    active = andnot(active, hit & done);
+                }
+
+                glm::vec3 background =
+                    glm::mix(cloud.sky_color, glm::vec3(1.f), (float)y / res.y);
+
+                float channels[3][W];
+                store(channels[0], color.x + splat(background.x) * transmittance);
+                store(channels[1], color.y + splat(background.y) * transmittance);
+                store(channels[2], color.z + splat(background.z) * transmittance);
+
+                uint16_t *out = rgba.data() + ((size_t)y * width + x) * 4;
+                for (uint32_t l = 0; l < std::min(W, width - x); ++l) {
+                    for (uint32_t c = 0; c < 3; ++c)
+                        out[l * 4 + c] = glm::packHalf1x16(channels[c][l]);
+                    out[l * 4 + 3] = glm::packHalf1x16(1.f);
+                }
+            }
+    });
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "vk_cloud.h"
+#include "vk_pool.h"
+
+/*
+    cpu version of light.comp and cloud.comp, for previews where there is no
+    gpu, and for diffing against the shaders.
+
+        vk_raymarch::volumes volumes;
+        volumes.cloudtex_size = 128;
+        vk_noise::cloudtex(pool, 128, volumes.cloudtex);
+        ...
+        vk_raymarch::light(pool, cloud, volumes);
+        vk_raymarch::trace(pool, volumes, cloud, camera, 1024, 768, rgba);
+
+    rays are traced vk_simd::W pixels at a time, in tiles spread over the pool.
+    it follows the imageLoad path, not SAMPLED, and composites over the
+    background like a full resolution trace without --temporal.
+*/
+
+namespace vk_raymarch
+{
+/* the images cloud.comp reads, in the layout vk_noise fills them */
+struct volumes {
+    uint32_t cloudtex_size = 0;
+    std::vector<float> cloudtex;
+
+    uint32_t weather_size = 0;
+    std::vector<float> weather;
+
+    /* light_extent in main.cpp */
+    glm::uvec3 light_size = glm::uvec3(128, 64, 128);
+    std::vector<float> light;
+};
+
+/* fills volumes.light the way light.comp rebuilds it whole */
+void light(thread_pool &pool, const cloud_data &cloud, volumes &volumes);
+
+/* width * height rgba16f texels, x fastest */
+void trace(thread_pool &pool, const volumes &volumes, const cloud_data &cloud,
+           const camera_data &camera, uint32_t width, uint32_t height,
+           std::vector<uint16_t> &rgba);
+} // namespace vk_raymarch
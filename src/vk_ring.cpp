@@ -0,0 +1,78 @@
+#include "vk_ring.h"
+
+#include <cstring>
+#include <iostream>
+
+static VkDeviceSize align_up(VkDeviceSize size, VkDeviceSize alignment)
+{
+    return alignment ? (size + alignment - 1) & ~(alignment - 1) : size;
+}
+
+void uniform_ring::init(VmaAllocator allocator, VkDeviceSize region_size,
+                        uint32_t regions, VkDeviceSize alignment)
+{
+    this->allocator = allocator;
+    this->alignment = alignment;
+    this->region_size = align_up(region_size, alignment);
+
+    VkBufferCreateInfo buffer_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    buffer_info.size = this->region_size * regions;
+    buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+    VmaAllocationCreateInfo vma_allocation_info = {};
+    vma_allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    vma_allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+
+    VmaAllocationInfo allocation_info;
+    VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &vma_allocation_info,
+                             &buffer.buffer, &buffer.allocation, &allocation_info));
+
+    buffer.size = buffer_info.size;
+    mapped = (char *)allocation_info.pMappedData;
+
+    base = 0;
+    head = 0;
+}
+
+void uniform_ring::destroy()
+{
+    if (buffer.buffer)
+        vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+
+    buffer = {};
+    mapped = nullptr;
+}
+
+allocated_buffer uniform_ring::view(VkDeviceSize size)
+{
+    return allocated_buffer{buffer.buffer, buffer.allocation, size};
+}
+
+void uniform_ring::begin_frame(uint32_t frame)
+{
+    base = frame * region_size;
+    head = base;
+}
+
+uint32_t uniform_ring::push(const void *data, size_t size)
+{
+    /* the descriptor range is padded, so is the room a uniform takes */
+    VkDeviceSize padded = align_up(size, alignment);
+
+    if (head + padded > base + region_size) {
+        std::cerr << "uniform ring: more than " << region_size
+                  << " bytes of uniforms in a frame" << std::endl;
+        abort();
+    }
+
+    std::memcpy(mapped + head, data, size);
+
+    /* a no-op on coherent memory */
+    VK_CHECK(vmaFlushAllocation(allocator, buffer.allocation, head, size));
+
+    uint32_t offset = head;
+    head += padded;
+
+    return offset;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <volk.h>
+
+#include "vk_mem_alloc.h"
+
+#include "vk_type.h"
+
+/*
+    One persistently mapped uniform buffer cut into a region per frame in
+    flight, uniforms are bump allocated from the region of the frame being
+    recorded and bound through the dynamic offset push returns.
+
+        ring.init(allocator, 1 << 16, FRAME_OVERLAP, min_buffer_alignment);
+        allocator.load_buffer("camera", ring.view(sizeof(camera_data)));
+        ...
+        ring.begin_frame(frame_index);          // after the frame's fence
+        uint32_t doffset = ring.push(&camera, sizeof(camera_data));
+
+    a region is only written again once the fence of its frame is waited on,
+    so the gpu never reads what the cpu is writing.
+*/
+
+struct uniform_ring {
+public:
+    void init(VmaAllocator allocator, VkDeviceSize region_size, uint32_t regions,
+              VkDeviceSize alignment);
+
+    void destroy();
+
+    /* the whole ring as a buffer of size, for descriptors with a dynamic offset */
+    allocated_buffer view(VkDeviceSize size);
+
+    void begin_frame(uint32_t frame);
+
+    /* copies data into this frame's region, returns its offset in the ring */
+    uint32_t push(const void *data, size_t size);
+
+private:
+    VmaAllocator allocator = VK_NULL_HANDLE;
+    allocated_buffer buffer = {};
+    char *mapped = nullptr;
+
+    VkDeviceSize region_size = 0;
+    VkDeviceSize alignment = 0;
+    VkDeviceSize base = 0;
+    VkDeviceSize head = 0;
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*
+    W lanes of float (vf), int (vi) and compare mask (vm), 8 on avx2, 4 on
+    arm64 neon and 1 otherwise. vk_noise and vk_raymarch are written once
+    against these, and have to be compiled with the same flags.
+
+        vf x = splat(2.f) * iota();
+        vf y = select(x < splat(4.f), vsin(x), vexp(x));
+*/
+
+namespace vk_simd
+{
+#if defined(__AVX2__)
+constexpr uint32_t W = 8;
+
+struct vf {
+    __m256 v;
+};
+
+struct vi {
+    __m256i v;
+};
+
+struct vm {
+    __m256 v;
+};
+
+inline vf splat(float a) { return { _mm256_set1_ps(a) }; }
+inline vi splat(int32_t a) { return { _mm256_set1_epi32(a) }; }
+inline vf iota() { return { _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f) }; }
+inline void store(float *p, vf a) { _mm256_storeu_ps(p, a.v); }
+
+inline vf operator+(vf a, vf b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline vf operator-(vf a, vf b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline vf operator*(vf a, vf b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline vf operator/(vf a, vf b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline vm operator==(vf a, vf b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+inline vm operator<(vf a, vf b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline vm operator<=(vf a, vf b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline vm operator>(vf a, vf b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline vm operator>=(vf a, vf b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+
+inline vm operator&(vm a, vm b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline vm operator|(vm a, vm b) { return { _mm256_or_ps(a.v, b.v) }; }
+inline vm andnot(vm a, vm b) { return { _mm256_andnot_ps(b.v, a.v) }; }
+inline bool any(vm m) { return _mm256_movemask_ps(m.v) != 0; }
+
+inline vf vfloor(vf a) { return { _mm256_floor_ps(a.v) }; }
+inline vf vmin(vf a, vf b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline vf vmax(vf a, vf b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline vf vsqrt(vf a) { return { _mm256_sqrt_ps(a.v) }; }
+inline vf select(vm m, vf a, vf b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+
+/* a with its sign flipped where m is set */
+inline vf flip(vm m, vf a)
+{
+    return { _mm256_xor_ps(a.v, _mm256_and_ps(m.v, _mm256_set1_ps(-0.f))) };
+}
+
+inline vi operator+(vi a, vi b) { return { _mm256_add_epi32(a.v, b.v) }; }
+inline vi operator-(vi a, vi b) { return { _mm256_sub_epi32(a.v, b.v) }; }
+inline vi operator*(vi a, vi b) { return { _mm256_mullo_epi32(a.v, b.v) }; }
+inline vi operator&(vi a, vi b) { return { _mm256_and_si256(a.v, b.v) }; }
+inline vm operator==(vi a, vi b)
+{
+    return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(a.v, b.v)) };
+}
+inline vm operator<(vi a, vi b)
+{
+    return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(b.v, a.v)) };
+}
+
+inline vi select(vm m, vi a, vi b)
+{
+    return { _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v)) };
+}
+
+/* truncating, like the int() and uint() casts in glsl */
+inline vi to_int(vf a) { return { _mm256_cvttps_epi32(a.v) }; }
+inline vf to_float(vi a) { return { _mm256_cvtepi32_ps(a.v) }; }
+
+inline vi gather(const int32_t *table, vi i)
+{
+    return { _mm256_i32gather_epi32(table, i.v, 4) };
+}
+
+inline vf gather(const float *table, vi i)
+{
+    return { _mm256_i32gather_ps(table, i.v, 4) };
+}
+
+/* 2^n for n in [-126, 127], straight into the exponent bits */
+inline vf exp2i(vi n)
+{
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(n.v, _mm256_set1_epi32(127)), 23);
+    return { _mm256_castsi256_ps(bits) };
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+constexpr uint32_t W = 4;
+
+struct vf {
+    float32x4_t v;
+};
+
+struct vi {
+    int32x4_t v;
+};
+
+struct vm {
+    uint32x4_t v;
+};
+
+inline vf splat(float a) { return { vdupq_n_f32(a) }; }
+inline vi splat(int32_t a) { return { vdupq_n_s32(a) }; }
+inline vf iota()
+{
+    static const float lanes[4] = { 0.f, 1.f, 2.f, 3.f };
+    return { vld1q_f32(lanes) };
+}
+inline void store(float *p, vf a) { vst1q_f32(p, a.v); }
+
+inline vf operator+(vf a, vf b) { return { vaddq_f32(a.v, b.v) }; }
+inline vf operator-(vf a, vf b) { return { vsubq_f32(a.v, b.v) }; }
+inline vf operator*(vf a, vf b) { return { vmulq_f32(a.v, b.v) }; }
+inline vf operator/(vf a, vf b) { return { vdivq_f32(a.v, b.v) }; }
+inline vm operator==(vf a, vf b) { return { vceqq_f32(a.v, b.v) }; }
+inline vm operator<(vf a, vf b) { return { vcltq_f32(a.v, b.v) }; }
+inline vm operator<=(vf a, vf b) { return { vcleq_f32(a.v, b.v) }; }
+inline vm operator>(vf a, vf b) { return { vcgtq_f32(a.v, b.v) }; }
+inline vm operator>=(vf a, vf b) { return { vcgeq_f32(a.v, b.v) }; }
+
+inline vm operator&(vm a, vm b) { return { vandq_u32(a.v, b.v) }; }
+inline vm operator|(vm a, vm b) { return { vorrq_u32(a.v, b.v) }; }
+inline vm andnot(vm a, vm b) { return { vbicq_u32(a.v, b.v) }; }
+inline bool any(vm m) { return vmaxvq_u32(m.v) != 0; }
+
+inline vf vfloor(vf a) { return { vrndmq_f32(a.v) }; }
+inline vf vmin(vf a, vf b) { return { vminq_f32(a.v, b.v) }; }
+inline vf vmax(vf a, vf b) { return { vmaxq_f32(a.v, b.v) }; }
+inline vf vsqrt(vf a) { return { vsqrtq_f32(a.v) }; }
+inline vf select(vm m, vf a, vf b) { return { vbslq_f32(m.v, a.v, b.v) }; }
+
+/* a with its sign flipped where m is set */
+inline vf flip(vm m, vf a)
+{
+    uint32x4_t sign = vandq_u32(m.v, vdupq_n_u32(0x80000000u));
+    return { vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a.v), sign)) };
+}
+
+inline vi operator+(vi a, vi b) { return { vaddq_s32(a.v, b.v) }; }
+inline vi operator-(vi a, vi b) { return { vsubq_s32(a.v, b.v) }; }
+inline vi operator*(vi a, vi b) { return { vmulq_s32(a.v, b.v) }; }
+inline vi operator&(vi a, vi b) { return { vandq_s32(a.v, b.v) }; }
+inline vm operator==(vi a, vi b) { return { vceqq_s32(a.v, b.v) }; }
+inline vm operator<(vi a, vi b) { return { vcltq_s32(a.v, b.v) }; }
+inline vi select(vm m, vi a, vi b) { return { vbslq_s32(m.v, a.v, b.v) }; }
+
+/* truncating, like the int() and uint() casts in glsl */
+inline vi to_int(vf a) { return { vcvtq_s32_f32(a.v) }; }
+inline vf to_float(vi a) { return { vcvtq_f32_s32(a.v) }; }
+
+/* no gather on neon, the table lookups go through memory */
+inline vi gather(const int32_t *table, vi i)
+{
+    int32_t lanes[4];
+    vst1q_s32(lanes, i.v);
+
+    for (uint32_t l = 0; l < 4; ++l)
+        lanes[l] = table[lanes[l]];
+
+    return { vld1q_s32(lanes) };
+}
+
+inline vf gather(const float *table, vi i)
+{
+    int32_t lanes[4];
+    float values[4];
+    vst1q_s32(lanes, i.v);
+
+    for (uint32_t l = 0; l < 4; ++l)
+        values[l] = table[lanes[l]];
+
+    return { vld1q_f32(values) };
+}
+
+/* 2^n for n in [-126, 127], straight into the exponent bits */
+inline vf exp2i(vi n)
+{
+    int32x4_t bits = vshlq_n_s32(vaddq_s32(n.v, vdupq_n_s32(127)), 23);
+    return { vreinterpretq_f32_s32(bits) };
+}
+
+#else
+constexpr uint32_t W = 1;
+
+struct vf {
+    float v;
+};
+
+struct vi {
+    int32_t v;
+};
+
+struct vm {
+    bool v;
+};
+
+inline vf splat(float a) { return { a }; }
+inline vi splat(int32_t a) { return { a }; }
+inline vf iota() { return { 0.f }; }
+inline void store(float *p, vf a) { *p = a.v; }
+
+inline vf operator+(vf a, vf b) { return { a.v + b.v }; }
+inline vf operator-(vf a, vf b) { return { a.v - b.v }; }
+inline vf operator*(vf a, vf b) { return { a.v * b.v }; }
+inline vf operator/(vf a, vf b) { return { a.v / b.v }; }
+inline vm operator==(vf a, vf b) { return { a.v == b.v }; }
+inline vm operator<(vf a, vf b) { return { a.v < b.v }; }
+inline vm operator<=(vf a, vf b) { return { a.v <= b.v }; }
+inline vm operator>(vf a, vf b) { return { a.v > b.v }; }
+inline vm operator>=(vf a, vf b) { return { a.v >= b.v }; }
+
+inline vm operator&(vm a, vm b) { return { a.v && b.v }; }
+inline vm operator|(vm a, vm b) { return { a.v || b.v }; }
+inline vm andnot(vm a, vm b) { return { a.v && !b.v }; }
+inline bool any(vm m) { return m.v; }
+
+inline vf vfloor(vf a) { return { std::floor(a.v) }; }
+inline vf vmin(vf a, vf b) { return { std::min(a.v, b.v) }; }
+inline vf vmax(vf a, vf b) { return { std::max(a.v, b.v) }; }
+inline vf vsqrt(vf a) { return { std::sqrt(a.v) }; }
+inline vf select(vm m, vf a, vf b) { return { m.v ? a.v : b.v }; }
+inline vf flip(vm m, vf a) { return { m.v ? -a.v : a.v }; }
+
+inline vi operator+(vi a, vi b) { return { a.v + b.v }; }
+inline vi operator-(vi a, vi b) { return { a.v - b.v }; }
+inline vi operator*(vi a, vi b) { return { a.v * b.v }; }
+inline vi operator&(vi a, vi b) { return { a.v & b.v }; }
+inline vm operator==(vi a, vi b) { return { a.v == b.v }; }
+inline vm operator<(vi a, vi b) { return { a.v < b.v }; }
+inline vi select(vm m, vi a, vi b) { return { m.v ? a.v : b.v }; }
+
+inline vi to_int(vf a) { return { (int32_t)a.v }; }
+inline vf to_float(vi a) { return { (float)a.v }; }
+
+inline vi gather(const int32_t *table, vi i) { return { table[i.v] }; }
+inline vf gather(const float *table, vi i) { return { table[i.v] }; }
+inline vf exp2i(vi n) { return { std::ldexp(1.f, n.v) }; }
+#endif
+
+inline float lane0(vf a)
+{
+    float lanes[W];
+    store(lanes, a);
+    return lanes[0];
+}
+
+inline vm bit(vi h, int32_t b) { return (h & splat(b)) == splat(b); }
+
+/* cephes sinf, reduced by the nearest multiple of pi / 2 in three parts */
+inline vf vsin(vf x)
+{
+    vf q = vfloor(x * splat(.63661977236758134f) + splat(.5f));
+    vf r = x - q * splat(1.5703125f) - q * splat(4.837512969970703125e-4f) -
+           q * splat(7.54978995489188216e-8f);
+    vi n = to_int(q) & splat(3);
+    vf r2 = r * r;
+
+    vf s = r + r * r2 *
+                   (splat(-1.6666654611e-1f) +
+                    r2 * (splat(8.3321608736e-3f) + r2 * splat(-1.9515295891e-4f)));
+    vf c = splat(1.f) - splat(.5f) * r2 +
+           r2 * r2 *
+               (splat(4.166664568298827e-2f) +
+                r2 * (splat(-1.388731625493765e-3f) + r2 * splat(2.443315711809948e-5f)));
+
+    return flip(bit(n, 2), select(bit(n, 1), c, s));
+}
+
+inline vf fract(vf a) { return a - vfloor(a); }
+
+/* glsl mod, a - b * floor(a / b) */
+inline vf vmod(vf a, float b) { return a - splat(b) * vfloor(a / splat(b)); }
+
+/* cephes expf, 2^n * e^r with r in [-ln 2 / 2, ln 2 / 2] */
+inline vf vexp(vf x)
+{
+    x = vmin(vmax(x, splat(-87.3365f)), splat(88.3762626647949f));
+
+    vf n = vfloor(x * splat(1.44269504088896341f) + splat(.5f));
+    vf r = x - n * splat(.693359375f) + n * splat(2.12194440e-4f);
+    vf r2 = r * r;
+
+    vf y = splat(1.9875691500e-4f);
+    y = y * r + splat(1.3981999507e-3f);
+    y = y * r + splat(8.3334519073e-3f);
+    y = y * r + splat(4.1665795894e-2f);
+    y = y * r + splat(1.6666665459e-1f);
+    y = y * r + splat(5.0000001201e-1f);
+    y = y * r2 + r + splat(1.f);
+
+    return y * exp2i(to_int(n));
+}
+} // namespace vk_simd
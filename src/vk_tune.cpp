@@ -0,0 +1,139 @@
+#include "vk_tune.h"
+
+#include <cfloat>
+#include <fstream>
+#include <iostream>
+
+#include "vk_cache.h"
+
+/* square and wide shapes, small ones for software rasterizers */
+static const std::vector<vk_tune::workgroup> candidates = {
+    {8, 8}, {16, 8}, {8, 16}, {16, 16}, {32, 4}, {32, 8}, {4, 4}, {64, 1},
+};
+
+bool vk_tune::read(const char *path, uint64_t key, workgroup &group)
+{
+    std::ifstream f(path);
+
+    uint64_t k;
+    workgroup g;
+    while (f >> std::hex >> k >> std::dec >> g.x >> g.y)
+        if (k == key) {
+            group = g;
+            return true;
+        }
+
+    return false;
+}
+
+bool vk_tune::write(const char *path, uint64_t key, workgroup group)
+{
+    std::vector<std::pair<uint64_t, workgroup>> lines;
+
+    {
+        std::ifstream f(path);
+
+        uint64_t k;
+        workgroup g;
+        while (f >> std::hex >> k >> std::dec >> g.x >> g.y)
+            if (k != key)
+                lines.push_back({k, g});
+    }
+
+    lines.push_back({key, group});
+
+    std::ofstream f(path, std::ios::trunc);
+
+    if (!f.is_open()) {
+        std::cerr << "tune: failed to open " << path << std::endl;
+        return false;
+    }
+
+    for (auto &line : lines)
+        f << std::hex << line.first << std::dec << " " << line.second.x << " "
+          << line.second.y << "\n";
+
+    return true;
+}
+
+void vk_tune::tuner::init(VkPhysicalDevice physical_device, const char *path,
+                          std::string name, uint64_t key, bool retune, bool timed)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    /* the same gpu on another driver is tuned again */
+    this->name = name;
+    this->key = vk_cache::fnv1a(name.data(), name.size(), key);
+    this->key = vk_cache::fnv1a(&properties.vendorID, sizeof(uint32_t), this->key);
+    this->key = vk_cache::fnv1a(&properties.deviceID, sizeof(uint32_t), this->key);
+    this->key = vk_cache::fnv1a(&properties.driverVersion, sizeof(uint32_t), this->key);
+
+    groups = {DEFAULT_GROUP};
+    best = 0;
+    tuning = false;
+
+    workgroup group;
+    if (path && !retune && read(path, this->key, group)) {
+        groups = {group};
+        return;
+    }
+
+    if (!timed || (!path && !retune))
+        return;
+
+    const VkPhysicalDeviceLimits &limits = properties.limits;
+
+    groups.clear();
+    for (const workgroup &g : candidates)
+        if (g.x <= limits.maxComputeWorkGroupSize[0] &&
+            g.y <= limits.maxComputeWorkGroupSize[1] &&
+            g.x * g.y <= limits.maxComputeWorkGroupInvocations)
+            groups.push_back(g);
+
+    tuning = true;
+}
+
+uint32_t vk_tune::tuner::pick(uint64_t frame_number)
+{
+    return tuning ? frame_number % groups.size() : best;
+}
+
+std::string vk_tune::tuner::label(uint32_t i)
+{
+    return name + " " + std::to_string(groups[i].x) + "x" + std::to_string(groups[i].y);
+}
+
+void vk_tune::tuner::update(gpu_profiler &profiler, const char *path)
+{
+    if (!tuning)
+        return;
+
+    double best_ms = DBL_MAX;
+    uint32_t fastest = 0;
+
+    for (uint32_t i = 0; i < groups.size(); ++i) {
+        std::string l = label(i);
+
+        const pass_stat *stat = nullptr;
+        for (const pass_stat &s : profiler.get_stats())
+            if (s.name == l)
+                stat = &s;
+
+        if (!stat || stat->samples < SAMPLES)
+            return;
+
+        if (stat->mean_ms < best_ms) {
+            best_ms = stat->mean_ms;
+            fastest = i;
+        }
+    }
+
+    best = fastest;
+    tuning = false;
+
+    std::cout << "tune: " << label(best) << " at " << best_ms << " ms" << std::endl;
+
+    if (path)
+        write(path, key, groups[best]);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <volk.h>
+
+#include "vk_profiler.h"
+
+/*
+    Workgroup shape of a 2d pass, timed against the other candidates in the
+    frames the pass runs anyway. The fastest is kept in a text file, a line
+    per device, driver and key, later runs start with it.
+
+        tuner.init(physical_device, "tune.cache", "cloud", key, false, true);
+        ... one pipeline per tuner.groups[i]
+
+        uint32_t i = tuner.pick(frame_number);
+        uint32_t q = profiler.begin(cbuffer, tuner.label(i));
+        vkCmdDispatch(...);
+        profiler.end(cbuffer, q);
+
+        tuner.update(profiler, "tune.cache");
+*/
+
+namespace vk_tune
+{
+struct workgroup {
+    uint32_t x;
+    uint32_t y;
+};
+
+/* the shaders default to 8x8 */
+static constexpr workgroup DEFAULT_GROUP = {8, 8};
+
+/* frames timed per candidate before settling */
+static constexpr uint32_t SAMPLES = 16;
+
+bool read(const char *path, uint64_t key, workgroup &group);
+bool write(const char *path, uint64_t key, workgroup group);
+
+struct tuner {
+public:
+    std::string name;
+    uint64_t key = 0;
+
+    /* the pipelines to build, a single one unless tuning */
+    std::vector<workgroup> groups = {DEFAULT_GROUP};
+    uint32_t best = 0;
+    bool tuning = false;
+
+    /*
+        starts from the stored shape, tunes when there is none or retune is
+        set; timed is false without timestamps, the default shape stays then
+    */
+    void init(VkPhysicalDevice physical_device, const char *path, std::string name,
+              uint64_t key, bool retune, bool timed);
+
+    /* the group to record this frame, best once tuning is over */
+    uint32_t pick(uint64_t frame_number);
+
+    std::string label(uint32_t i);
+
+    /* settles on the fastest once every candidate has SAMPLES timings */
+    void update(gpu_profiler &profiler, const char *path);
+};
+} // namespace vk_tune
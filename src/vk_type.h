@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <iostream>
+#include <mutex>
 #include <vector>
 #include <volk.h>
 
@@ -33,14 +34,24 @@ struct allocated_img {
     VmaAllocation allocation;
     VkImageView img_view;
     VkFormat format;
+
+    /* one view per level when there is a mip chain, img_view covers all of it */
+    std::vector<VkImageView> mip_views;
 };
 
 struct deletion_queue {
 public:
-    void push_back(std::function<void()> &&f) { fs.push_back(f); }
+    /* pipelines are compiled on worker threads, see pipeline_queue */
+    void push_back(std::function<void()> &&f)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fs.push_back(f);
+    }
 
     void flush()
     {
+        std::lock_guard<std::mutex> lock(mutex);
+
         for (auto f = fs.rbegin(); f != fs.rend(); f++)
             (*f)();
 
@@ -48,6 +59,7 @@ public:
     };
 
     std::vector<std::function<void()>> fs;
+    std::mutex mutex;
 };
 
 inline static deletion_queue deletion_queue;
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "vk_upload.h"
+
+#include <cstring>
+#include <utility>
+
+#include "vk_boiler.h"
+
+/* a multiple of every texel size, buffer to image copies need that offset */
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+static allocated_buffer create_staging(VmaAllocator allocator, VkDeviceSize size,
+                                       char **mapped)
+{
+    VkBufferCreateInfo buffer_info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo vma_allocation_info = {};
+    vma_allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                                VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    vma_allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+
+    allocated_buffer buffer = {};
+    VmaAllocationInfo allocation_info;
+    VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &vma_allocation_info,
+                             &buffer.buffer, &buffer.allocation, &allocation_info));
+    buffer.size = size;
+    *mapped = (char *)allocation_info.pMappedData;
+
+    return buffer;
+}
+
+void upload_batcher::init(VkDevice device, VmaAllocator allocator, VkQueue queue,
+                          uint32_t family, VkDeviceSize size)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->queue = queue;
+
+    VkCommandPoolCreateInfo cpool_info = vk_boiler::cpool_create_info(family);
+    VK_CHECK(vkCreateCommandPool(device, &cpool_info, nullptr, &cpool));
+
+    VkSemaphoreTypeCreateInfo type_info = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo sem_info = vk_boiler::sem_create_info();
+    sem_info.pNext = &type_info;
+    VK_CHECK(vkCreateSemaphore(device, &sem_info, nullptr, &timeline));
+
+    ring = create_staging(allocator, size, &mapped);
+
+    submitted = 0;
+    head = 0;
+    used = 0;
+}
+
+void upload_batcher::destroy()
+{
+    if (!timeline)
+        return;
+
+    flush();
+
+    vmaDestroyBuffer(allocator, ring.buffer, ring.allocation);
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroyCommandPool(device, cpool, nullptr);
+
+    ring = {};
+    mapped = nullptr;
+    timeline = VK_NULL_HANDLE;
+    cpool = VK_NULL_HANDLE;
+    free_cbuffers.clear();
+}
+
+VkCommandBuffer upload_batcher::cbuffer()
+{
+    if (recording)
+        return open.cbuffer;
+
+    retire();
+
+    open = {};
+
+    if (free_cbuffers.empty()) {
+        VkCommandBufferAllocateInfo cbuffer_allocate_info =
+            vk_boiler::cbuffer_allocate_info(1, cpool);
+        VK_CHECK(vkAllocateCommandBuffers(device, &cbuffer_allocate_info, &open.cbuffer));
+    } else {
+        open.cbuffer = free_cbuffers.back();
+        free_cbuffers.pop_back();
+    }
+
+    VkCommandBufferBeginInfo cbuffer_begin_info = vk_boiler::cbuffer_begin_info();
+    VK_CHECK(vkBeginCommandBuffer(open.cbuffer, &cbuffer_begin_info));
+
+    recording = true;
+    return open.cbuffer;
+}
+
+void upload_batcher::copy_buffer(const void *data, VkDeviceSize size, VkBuffer dst,
+                                 VkDeviceSize dst_offset)
+{
+    if (size == 0)
+        return;
+
+    VkBuffer src;
+    VkBufferCopy region = {};
+    region.srcOffset = stage(data, size, &src);
+    region.dstOffset = dst_offset;
+    region.size = size;
+
+    vkCmdCopyBuffer(open.cbuffer, src, dst, 1, &region);
+}
+
+void upload_batcher::copy_img(const void *data, VkDeviceSize size, VkImage img,
+                              VkExtent3D extent)
+{
+    if (size == 0)
+        return;
+
+    VkBuffer src;
+    VkBufferImageCopy region = vk_boiler::buffer_img_copy(extent);
+    region.bufferOffset = stage(data, size, &src);
+
+    vkCmdCopyBufferToImage(open.cbuffer, src, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1, &region);
+}
+
+uint64_t upload_batcher::submit()
+{
+    if (!recording)
+        return submitted;
+
+    VK_CHECK(vkEndCommandBuffer(open.cbuffer));
+
+    open.value = ++submitted;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &open.value;
+
+    VkSubmitInfo submit_info =
+        vk_boiler::submit_info(&open.cbuffer, nullptr, &timeline, nullptr);
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = 0;
+
+    VK_CHECK(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    pending.push_back(std::move(open));
+    open = {};
+    recording = false;
+
+    return submitted;
+}
+
+void upload_batcher::wait(uint64_t value)
+{
+    VkSemaphoreWaitInfo wait_info = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &timeline;
+    wait_info.pValues = &value;
+
+    VK_CHECK(vkWaitSemaphores(device, &wait_info, UINT64_MAX));
+
+    retire();
+}
+
+void upload_batcher::flush()
+{
+    wait(submit());
+}
+
+VkDeviceSize upload_batcher::stage(const void *data, VkDeviceSize size, VkBuffer *src)
+{
+    /* never fits the ring, staged on its own and freed with the batch */
+    if (size > ring.size) {
+        char *dedicated_mapped;
+        allocated_buffer buffer = create_staging(allocator, size, &dedicated_mapped);
+
+        std::memcpy(dedicated_mapped, data, size);
+        VK_CHECK(vmaFlushAllocation(allocator, buffer.allocation, 0, size));
+
+        cbuffer();
+        open.dedicated.push_back(buffer);
+
+        *src = buffer.buffer;
+        return 0;
+    }
+
+    VkDeviceSize offset;
+    VkDeviceSize padding;
+
+    for (;;) {
+        offset = (head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+        padding = offset - head;
+
+        /* no room before the end, the rest of it is skipped */
+        if (offset + size > ring.size) {
+            offset = 0;
+            padding = ring.size - head;
+        }
+
+        if (used + padding + size <= ring.size)
+            break;
+
+        /* the oldest batch holds the space, the open one may be it */
+        if (pending.empty())
+            submit();
+
+        wait(pending.front().value);
+    }
+
+    /* begun after the waits, the copy lands in the batch that owns the bytes */
+    cbuffer();
+
+    std::memcpy(mapped + offset, data, size);
+
+    /* a no-op on coherent memory */
+    VK_CHECK(vmaFlushAllocation(allocator, ring.allocation, offset, size));
+
+    open.bytes += padding + size;
+    used += padding + size;
+    head = offset + size;
+
+    *src = ring.buffer;
+    return offset;
+}
+
+void upload_batcher::retire()
+{
+    uint64_t done;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, timeline, &done));
+
+    while (!pending.empty() && pending.front().value <= done) {
+        batch &oldest = pending.front();
+
+        for (allocated_buffer &buffer : oldest.dedicated)
+            vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+
+        VK_CHECK(vkResetCommandBuffer(oldest.cbuffer, 0));
+        free_cbuffers.push_back(oldest.cbuffer);
+
+        used -= oldest.bytes;
+        pending.pop_front();
+    }
+
+    /* nothing staged is alive, start over at the front */
+    if (used == 0)
+        head = 0;
+}
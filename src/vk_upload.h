@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <volk.h>
+
+#include "vk_mem_alloc.h"
+
+#include "vk_type.h"
+
+/*
+    Staging copies batched into one command buffer and submitted together.
+    Data goes through one persistently mapped ring, a batch's part of the
+    ring is reused once the timeline semaphore reaches the value its submit
+    signals.
+
+        uploads.init(device, allocator, transfer_queue, transfer_index, 1 << 26);
+        uploads.copy_buffer(vertices, size, vertex_buffer, 0);
+        vk_img_layout_transition(uploads.cbuffer(), img, ... TRANSFER_DST ...);
+        uploads.copy_img(texels, size, img, extent);
+        ...
+        uint64_t value = uploads.submit();
+        uploads.wait(value);        // before another queue uses what was copied
+
+    when the ring is full the open batch is submitted and the oldest waited on,
+    an upload larger than the whole ring gets a staging buffer of its own that
+    is freed with its batch. Every recorded command runs in submission order on
+    the one queue, barriers recorded through cbuffer() hold across batches.
+*/
+
+struct upload_batcher {
+public:
+    void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t family,
+              VkDeviceSize size);
+
+    /* waits for everything submitted */
+    void destroy();
+
+    /* the batch being recorded, one is begun when there is none */
+    VkCommandBuffer cbuffer();
+
+    void copy_buffer(const void *data, VkDeviceSize size, VkBuffer dst,
+                     VkDeviceSize dst_offset);
+
+    /* the whole of mip 0, img already in TRANSFER_DST_OPTIMAL */
+    void copy_img(const void *data, VkDeviceSize size, VkImage img, VkExtent3D extent);
+
+    /* value the batch signals when done, the last submitted one if none is open */
+    uint64_t submit();
+
+    void wait(uint64_t value);
+
+    /* submit and wait, the copies are complete after */
+    void flush();
+
+private:
+    struct batch {
+        VkCommandBuffer cbuffer;
+        uint64_t value;
+        VkDeviceSize bytes;
+        std::vector<allocated_buffer> dedicated;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VmaAllocator allocator = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+
+    VkCommandPool cpool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> free_cbuffers;
+
+    /* signalled with a batch's value once its copies are done */
+    VkSemaphore timeline = VK_NULL_HANDLE;
+    uint64_t submitted = 0;
+
+    allocated_buffer ring = {};
+    char *mapped = nullptr;
+    VkDeviceSize head = 0;
+    VkDeviceSize used = 0;
+
+    /* submitted and not known to be done, oldest first */
+    std::deque<batch> pending;
+    batch open = {};
+    bool recording = false;
+
+    /* staging offset of size bytes in the open batch, data copied in */
+    VkDeviceSize stage(const void *data, VkDeviceSize size, VkBuffer *src);
+
+    /* frees what the batches the gpu is done with held */
+    void retire();
+};
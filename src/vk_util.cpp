@@ -3,6 +3,7 @@
 #include <fstream>
 
 #include "vk_boiler.h"
+#include "vk_cmd.h"
 #include "vk_type.h"
 
 void vk_engine::immediate_submit(std::function<void(VkCommandBuffer cmd)> &&fs)
@@ -93,10 +94,26 @@ void vk_engine::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
     VK_CHECK(vmaCreateBuffer(_allocator, &buffer_info, &vma_allocation_info,
                              &buffer->buffer, &buffer->allocation, nullptr));
 
+    buffer->size = size;
+
     deletion_queue.push_back(
         [=]() { vmaDestroyBuffer(_allocator, buffer->buffer, buffer->allocation); });
 }
 
+void vk_engine::upload_buffer(const void *data, VkDeviceSize size,
+                              VkBufferUsageFlags usage, allocated_buffer *buffer)
+{
+    create_buffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, buffer);
+
+    /* only recorded, the buffer is usable once _uploads is flushed */
+    _uploads.copy_buffer(data, size, buffer->buffer, 0);
+
+    ownership_transfer transfer = {};
+    transfer.buffer = buffer->buffer;
+    transfer.src_index = _transfer_index;
+    release(_uploads.cbuffer(), transfer);
+}
+
 void vk_engine::create_img(VkFormat format, VkExtent3D extent, VkImageAspectFlags aspect,
                            VkImageUsageFlags usage, VmaAllocationCreateFlags flags,
                            allocated_img *img)
@@ -132,3 +149,54 @@ size_t vk_engine::pad_uniform_buffer_size(size_t original_size)
             (aligned_size + _min_buffer_alignment - 1) & ~(_min_buffer_alignment - 1);
     return aligned_size;
 }
+
+void vk_engine::release(VkCommandBuffer cbuffer, ownership_transfer transfer)
+{
+    /* already on the graphics family, a plain barrier orders the writes */
+    if (transfer.src_index == _gfx_index) {
+        if (transfer.img)
+            vk_cmd::vk_img_layout_transition(cbuffer, transfer.img, transfer.old_layout,
+                                             transfer.new_layout, _gfx_index);
+        return;
+    }
+
+    if (transfer.img)
+        vk_cmd::vk_img_layout_transition(cbuffer, transfer.img, transfer.old_layout,
+                                         transfer.new_layout, transfer.src_index,
+                                         _gfx_index);
+    else
+        vk_cmd::vk_buffer_ownership_transfer(cbuffer, transfer.buffer,
+                                             transfer.src_index, _gfx_index);
+
+    _acquires.push_back(transfer);
+}
+
+void vk_engine::acquire(VkCommandBuffer cbuffer)
+{
+    /* the acquiring half has to repeat the release barrier exactly */
+    for (ownership_transfer &transfer : _acquires) {
+        if (transfer.img)
+            vk_cmd::vk_img_layout_transition(cbuffer, transfer.img, transfer.old_layout,
+                                             transfer.new_layout, transfer.src_index,
+                                             _gfx_index);
+        else
+            vk_cmd::vk_buffer_ownership_transfer(cbuffer, transfer.buffer,
+                                                 transfer.src_index, _gfx_index);
+    }
+
+    _acquires.clear();
+}
+
+void vk_engine::build_mips(VkCommandBuffer cbuffer)
+{
+    /* blits need the graphics queue, the images are on it by now */
+    for (mip_build &build : _mip_builds) {
+        vk_cmd::vk_img_mips(cbuffer, build.img, build.extent, build.mip_levels);
+
+        if (build.layout != VK_IMAGE_LAYOUT_GENERAL)
+            vk_cmd::vk_img_layout_transition(cbuffer, build.img, VK_IMAGE_LAYOUT_GENERAL,
+                                             build.layout, _gfx_index);
+    }
+
+    _mip_builds.clear();
+}